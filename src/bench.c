@@ -0,0 +1,627 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "lzw.h"
+#include "fmap.h"
+#include "ctxpool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define BENCH_TSC()	__rdtsc()
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <x86intrin.h>
+#define BENCH_TSC()	__rdtsc()
+#endif
+
+#define BENCH_SIZE		(1 << 22)	// default size of the synthetic data
+#define BENCH_RUNS		5			// default number of measured runs
+#define BENCH_WARMUP	1			// default number of warm-up runs
+#define BENCH_RUNS_MAX	1000
+#define BENCH_BATCH_MAX	64			// maximal number of streams encoded together
+
+// output stream: a preallocated memory buffer
+typedef struct _stream
+{
+	char          *buf;		// memory buffer
+	unsigned      size;		// number of bytes in the buffer
+	unsigned      cap;		// buffer capacity
+}
+stream_t;
+
+// test data
+typedef struct _sample
+{
+	const char    *name;	// file name or synthetic data name
+	char          *data;
+	unsigned      size;
+}
+sample_t;
+
+// measurements of one codec direction
+typedef struct _timing
+{
+	double        sec[BENCH_RUNS_MAX];		// run times
+	double        cycles[BENCH_RUNS_MAX];	// run TSC cycles
+}
+timing_t;
+
+static void stream_write(void *stream, char *buf, unsigned size)
+{
+	stream_t *s = (stream_t*)stream;
+
+	if (s->size + size > s->cap) {
+		fprintf(stderr, "Output buffer overflow\n");
+		exit(-4);
+	}
+
+	memcpy(s->buf + s->size, buf, size);
+	s->size += size;
+}
+
+/******************************************************************************
+**  bench_time
+**  --------------------------------------------------------------------------
+**  Returns monotonic time.
+**
+**  Arguments: -
+**
+**  Return: time in seconds
+******************************************************************************/
+static double bench_time(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER t, f;
+
+	QueryPerformanceCounter(&t);
+	QueryPerformanceFrequency(&f);
+	return (double)t.QuadPart / (double)f.QuadPart;
+#else
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+#endif
+}
+
+/******************************************************************************
+**  bench_cycles
+**  --------------------------------------------------------------------------
+**  Returns CPU time stamp counter.
+**
+**  Arguments: -
+**
+**  Return: number of cycles or 0 if the counter is not available
+******************************************************************************/
+static double bench_cycles(void)
+{
+#ifdef BENCH_TSC
+	return (double)BENCH_TSC();
+#else
+	return 0;
+#endif
+}
+
+/******************************************************************************
+**  bench_random
+**  --------------------------------------------------------------------------
+**  Pseudo-random generator, the synthetic data is the same on all systems.
+**
+**  Arguments:
+**      seed - generator state;
+**
+**  Return: 16 random bits
+******************************************************************************/
+static unsigned bench_random(unsigned *seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return (*seed >> 16) & 0xFFFF;
+}
+
+/******************************************************************************
+**  bench_synth
+**  --------------------------------------------------------------------------
+**  Generates synthetic data:
+**      zeros  - the longest strings, the fewest codes;
+**      random - incompressible data, every code is a new string;
+**      text   - words of a random vocabulary with skewed frequencies;
+**      reset  - random symbols of 16-letter alphabet, the dictionary
+**               fills up fast and lzw_enc_reset is called many times.
+**
+**  Arguments:
+**      s    - sample to fill, s->name selects the data;
+**      size - data size;
+**
+**  Return: 0 or -1 if there is no memory
+******************************************************************************/
+static int bench_synth(sample_t *s, unsigned size)
+{
+	unsigned seed = 1;
+	unsigned i;
+
+	if (!(s->data = (char*)malloc(size)))
+		return -1;
+
+	s->size = size;
+
+	if (!strcmp(s->name, "zeros"))
+	{
+		memset(s->data, 0, size);
+	}
+	else if (!strcmp(s->name, "random"))
+	{
+		for (i = 0; i < size; i++)
+			s->data[i] = (char)bench_random(&seed);
+	}
+	else if (!strcmp(s->name, "reset"))
+	{
+		for (i = 0; i < size; i++)
+			s->data[i] = (char)('a' + (bench_random(&seed) & 15));
+	}
+	else // text
+	{
+		char     words[1024][12];
+		unsigned j, k;
+
+		for (j = 0; j < 1024; j++)
+		{
+			unsigned len = 2 + bench_random(&seed) % 9;
+
+			for (k = 0; k < len; k++)
+				words[j][k] = (char)('a' + bench_random(&seed) % 26);
+			words[j][len] = 0;
+		}
+
+		for (i = 0; i < size;)
+		{
+			// the product of two uniform numbers favours short indexes
+			const char *w = words[(bench_random(&seed) % 32) * (bench_random(&seed) % 32)];
+
+			for (k = 0; w[k] && i < size; k++)
+				s->data[i++] = w[k];
+			if (i < size)
+				s->data[i++] = bench_random(&seed) % 10 ? ' ' : '\n';
+		}
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+**  bench_load
+**  --------------------------------------------------------------------------
+**  Reads the file into memory.
+**
+**  Arguments:
+**      s - sample to fill, s->name is the file name;
+**
+**  Return: 0 or error code
+******************************************************************************/
+static int bench_load(sample_t *s)
+{
+	FILE   *f;
+	fmap_t map;
+	int    ret = 0;
+
+	if (!(f = fopen(s->name, "rb"))) {
+		fprintf(stderr, "Cannot open %s\n", s->name);
+		return -2;
+	}
+
+	if (fmap_open(&map, f)) {
+		fprintf(stderr, "Cannot map %s\n", s->name);
+		ret = -2;
+	}
+	else
+	{
+		if (map.size > 0x7FFFFFFF) {
+			fprintf(stderr, "%s is too big\n", s->name);
+			ret = -2;
+		}
+		else if (!(s->data = (char*)malloc((size_t)map.size))) {
+			fprintf(stderr, "Out of memory\n");
+			ret = -4;
+		}
+		else
+		{
+			// the copy is not affected by page faults of the mapping
+			memcpy(s->data, map.data, (size_t)map.size);
+			s->size = (unsigned)map.size;
+		}
+
+		fmap_close(&map);
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+/******************************************************************************
+**  bench_cmp
+**  --------------------------------------------------------------------------
+**  Compares two measurements for qsort.
+******************************************************************************/
+static int bench_cmp(const void *a, const void *b)
+{
+	const double x = *(const double*)a;
+	const double y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/******************************************************************************
+**  bench_pct
+**  --------------------------------------------------------------------------
+**  Returns the percentile of the sorted measurements.
+**
+**  Arguments:
+**      v   - sorted measurements;
+**      n   - number of measurements;
+**      pct - percentile 0..100;
+**
+**  Return: measurement
+******************************************************************************/
+static double bench_pct(const double *v, unsigned n, unsigned pct)
+{
+	return v[(n - 1) * pct / 100 + ((n - 1) * pct % 100 != 0)];
+}
+
+/******************************************************************************
+**  bench_check_stream
+**  --------------------------------------------------------------------------
+**  Checks lzw_dec_stream on the GIF and TIFF streams followed by other
+**  data: the stream is decoded with the input and the output cut into
+**  pieces of several sizes, the decoded data and the position of the
+**  input cursor after EOI code are compared.
+**
+**  Arguments: -
+**
+**  Return: 0 or error code
+******************************************************************************/
+static int bench_check_stream(void)
+{
+	static const unsigned dialect[] = {LZW_DIALECT_GIF, LZW_DIALECT_TIFF};
+	static const unsigned pieces[]  = {1, 2, 3, 7, 64, 1000, 16384};
+	static const char     trailer[] = "TRAILERBYTES";
+	static char           zbuf[16384], obuf[8192];
+	sample_t              t;
+	stream_t              z;
+	lzw_enc_t             *enc;
+	lzw_dec_t             *dec;
+	unsigned              d, i, k;
+	int                   ret = 0;
+
+	t.name = "text";
+	if (bench_synth(&t, 5000)) {
+		fprintf(stderr, "Out of memory\n");
+		return -4;
+	}
+
+	for (d = 0; !ret && d < sizeof(dialect) / sizeof(dialect[0]); d++)
+	{
+		enc = lzw_enc_create(12);
+		dec = lzw_dec_create(12);
+		if (!enc || !dec) {
+			fprintf(stderr, "Out of memory\n");
+			ret = -4;
+			break;
+		}
+
+		z.buf  = zbuf;
+		z.size = 0;
+		z.cap  = sizeof(zbuf) - sizeof(trailer);
+		lzw_enc_flags(enc, dialect[d]);
+		lzw_enc_sink(enc, stream_write);
+		lzw_enc_init(enc, &z);
+		lzw_encode(enc, t.data, t.size);
+		lzw_enc_end(enc);
+		memcpy(zbuf + z.size, trailer, sizeof(trailer));
+
+		lzw_dec_flags(dec, dialect[d]);
+
+		for (i = 0; !ret && i < sizeof(pieces) / sizeof(pieces[0]); i++)
+		{
+			for (k = 0; !ret && k < sizeof(pieces) / sizeof(pieces[0]); k++)
+			{
+				char     *end = zbuf + z.size + sizeof(trailer);
+				lzw_io_t io;
+
+				lzw_dec_init(dec, NULL);
+				io.next_in  = zbuf;
+				io.next_out = obuf;
+
+				// the input cut into pieces[i] bytes, the output into pieces[k] bytes
+				do
+				{
+					const char *in  = io.next_in;
+					const char *out = io.next_out;
+
+					io.avail_in  = (unsigned)(end - in) < pieces[i] ? (unsigned)(end - in) : pieces[i];
+					io.avail_out = sizeof(obuf) - (unsigned)(out - obuf) < pieces[k] ? sizeof(obuf) - (unsigned)(out - obuf) : pieces[k];
+					ret = lzw_dec_stream(dec, &io);
+
+					// no progress: the input ends before EOI code
+					if (io.next_in == in && io.next_out == out)
+						break;
+				}
+				while (!ret);
+
+				if (ret != LZW_STREAM_END || io.next_in != zbuf + z.size
+					|| io.next_out - obuf != (long)t.size || memcmp(obuf, t.data, t.size))
+				{
+					fprintf(stderr, "Stream check failed: flags %x, input by %u, output by %u (%d)\n",
+						dialect[d], pieces[i], pieces[k], ret);
+					ret = -5;
+				}
+				else
+					ret = 0;
+			}
+		}
+
+		lzw_enc_destroy(enc);
+		lzw_dec_destroy(dec);
+	}
+
+	free(t.data);
+
+	return ret;
+}
+
+/******************************************************************************
+**  bench_sample
+**  --------------------------------------------------------------------------
+**  Encodes and decodes the sample several times, checks the decoded data
+**  and prints the median and 99th percentile speed. The sample may be
+**  split into short streams, every stream takes the contexts from the pool
+**  and puts them back. The batches of the streams are encoded together
+**  by lzw_encode_batch.
+**
+**  Arguments:
+**      s      - sample;
+**      pool   - pool of the codec contexts;
+**      piece  - size of the streams, 0 - the sample is one stream;
+**      batch  - number of streams encoded together;
+**      runs   - number of measured runs;
+**      warmup - number of runs which are not measured;
+**      csv    - print comma separated values;
+**
+**  Return: 0 or error code
+******************************************************************************/
+static int bench_sample(const sample_t *s, ctx_pool_t *pool, unsigned piece, unsigned batch, unsigned runs, unsigned warmup, int csv)
+{
+	static timing_t te, td;
+	lzw_enc_t       *enc[BENCH_BATCH_MAX];
+	char            *ibuf[BENCH_BATCH_MAX];
+	unsigned        isize[BENCH_BATCH_MAX];
+	stream_t        *z, out;
+	double          t, c, mb = s->size / 1e6;
+	char            *zbuf;
+	unsigned        zcap, zsize;
+	unsigned        i, j, k, m, n;
+	int             ret = 0;
+
+	if (!piece || piece > s->size)
+		piece = s->size ? s->size : 1;
+	n = s->size ? (s->size + piece - 1) / piece : 1;
+
+	// the streams of a batch are written at once, z[k] - the part of the buffer of the stream k
+	zcap    = lzw_compress_bound(piece) + 8;
+	out.cap = s->size;
+	zbuf    = (char*)malloc((size_t)n * zcap);
+	out.buf = (char*)malloc(out.cap ? out.cap : 1);
+	z       = (stream_t*)malloc(n * sizeof(stream_t));
+
+	if (!zbuf || !out.buf || !z) {
+		fprintf(stderr, "Out of memory\n");
+		return -4;
+	}
+
+	for (k = 0; k < n; k++)
+	{
+		z[k].buf = zbuf + (size_t)k * zcap;
+		z[k].cap = zcap;
+	}
+
+	for (i = 0; i < warmup + runs; i++)
+	{
+		t = bench_time();
+		c = bench_cycles();
+		for (k = 0; k < n; k += m)
+		{
+			m = n - k < batch ? n - k : batch;
+
+			for (j = 0; j < m; j++)
+			{
+				enc[j] = ctx_pool_enc(pool);
+				lzw_enc_sink(enc[j], stream_write);
+
+				ibuf[j]     = s->data + (k+j)*piece;
+				isize[j]    = s->size - (k+j)*piece < piece ? s->size - (k+j)*piece : piece;
+				z[k+j].size = 0;
+				lzw_enc_init(enc[j], &z[k+j]);
+			}
+
+			lzw_encode_batch(enc, ibuf, isize, m);
+
+			for (j = 0; j < m; j++)
+			{
+				lzw_enc_end(enc[j]);
+				ctx_pool_put_enc(pool, enc[j]);
+			}
+		}
+		if (i >= warmup) {
+			te.cycles[i - warmup] = bench_cycles() - c;
+			te.sec[i - warmup]    = bench_time() - t;
+		}
+
+		out.size = 0;
+		t = bench_time();
+		c = bench_cycles();
+		for (k = 0, ret = 0; ret >= 0 && k < n; k++)
+		{
+			lzw_dec_t *dec = ctx_pool_dec(pool);
+
+			lzw_dec_sink(dec, stream_write);
+
+			lzw_dec_init(dec, &out);
+			ret = lzw_decode(dec, z[k].buf, z[k].size);
+			ctx_pool_put_dec(pool, dec);
+		}
+		if (i >= warmup) {
+			td.cycles[i - warmup] = bench_cycles() - c;
+			td.sec[i - warmup]    = bench_time() - t;
+		}
+
+		if (ret < 0 || out.size != s->size || memcmp(out.buf, s->data, s->size)) {
+			fprintf(stderr, "%s: decoded data differs (%d)\n", s->name, ret);
+			ret = -5;
+			break;
+		}
+
+		ret = 0;
+	}
+
+	for (k = 0, zsize = 0; k < n; k++)
+		zsize += z[k].size;
+
+	if (!ret)
+	{
+		qsort(te.sec, runs, sizeof(double), bench_cmp);
+		qsort(td.sec, runs, sizeof(double), bench_cmp);
+		qsort(te.cycles, runs, sizeof(double), bench_cmp);
+		qsort(td.cycles, runs, sizeof(double), bench_cmp);
+
+		// the 99th percentile of the time is the slow end of the speed
+		printf(csv ? "%s,%u,%u,%.4f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n"
+			: "%-16s %10u %10u %7.4f %9.2f %9.2f %7.2f %9.2f %9.2f %7.2f\n",
+			s->name, s->size, zsize, s->size ? (double)zsize / s->size : 0.0,
+			mb / bench_pct(te.sec, runs, 50), mb / bench_pct(te.sec, runs, 99),
+			s->size ? bench_pct(te.cycles, runs, 50) / s->size : 0.0,
+			mb / bench_pct(td.sec, runs, 50), mb / bench_pct(td.sec, runs, 99),
+			s->size ? bench_pct(td.cycles, runs, 50) / s->size : 0.0);
+	}
+
+	free(zbuf);
+	free(out.buf);
+	free(z);
+
+	return ret;
+}
+
+/******************************************************************************
+**  main
+**  --------------------------------------------------------------------------
+**  Measures the encoder and decoder speed. Without files the synthetic data
+**  is used, corpus files (Silesia, Canterbury etc.) can be given instead.
+**
+**  Arguments:
+**      -m      - number of bits in the maximal code;
+**      -r      - number of measured runs;
+**      -w      - number of warm-up runs;
+**      -s      - size of the synthetic data in KB;
+**      -n      - size of the short streams the data is split into;
+**      -b      - number of the short streams encoded together;
+**      -c      - print comma separated values;
+**      argv[1] - input file names;
+**
+**  Return: error code
+******************************************************************************/
+int main (int argc, char* argv[])
+{
+	static const char *synth[] = {"zeros", "random", "text", "reset"};
+	ctx_pool_t pool;
+	sample_t   s;
+	unsigned   max_bits = DICT_BITS;
+	unsigned   runs     = BENCH_RUNS;
+	unsigned   warmup   = BENCH_WARMUP;
+	unsigned   size     = BENCH_SIZE;
+	unsigned   piece    = 0;
+	unsigned   batch    = 1;
+	unsigned   nsynth   = 0;
+	int        csv      = 0;
+	int        ret      = 0;
+	int        i;
+
+	while (argc > 1 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'c') {
+			csv = 1;
+			argc--;
+			argv++;
+			continue;
+		}
+
+		if (argc < 3)
+			break;
+		else if (argv[1][1] == 'm')
+			max_bits = atoi(argv[2]);
+		else if (argv[1][1] == 'r')
+			runs = atoi(argv[2]);
+		else if (argv[1][1] == 'w')
+			warmup = atoi(argv[2]);
+		else if (argv[1][1] == 's')
+			size = atoi(argv[2]) * 1024;
+		else if (argv[1][1] == 'n')
+			piece = atoi(argv[2]);
+		else if (argv[1][1] == 'b')
+			batch = atoi(argv[2]);
+		else
+			break;
+
+		argc -= 2;
+		argv += 2;
+	}
+
+	if ((argc > 1 && argv[1][0] == '-') || !runs || runs > BENCH_RUNS_MAX || !batch || batch > BENCH_BATCH_MAX) {
+		printf("Usage: lzw-bench [-m <max code bits>] [-r <runs>] [-w <warm-up runs>] [-s <synthetic data size KB>] [-n <stream size>] [-b <streams>] [-c] [<input files>]\n");
+		return -1;
+	}
+
+	// the streams of the tools and other applications are cut anywhere
+	if ((ret = bench_check_stream()) != 0)
+		return ret;
+
+	if (ctx_pool_init(&pool, max_bits, 0, NULL, 0, batch, batch, 1)) {
+		fprintf(stderr, "Cannot create codec with %u bits\n", max_bits);
+		return -4;
+	}
+
+	printf(csv ? "name,size,csize,ratio,enc_mbs,enc_mbs_p99,enc_cpb,dec_mbs,dec_mbs_p99,dec_cpb\n"
+		: "%-16s %10s %10s %7s %9s %9s %7s %9s %9s %7s\n",
+		"name", "size", "csize", "ratio", "enc MB/s", "p99", "cyc/B", "dec MB/s", "p99", "cyc/B");
+
+	if (argc < 2)
+		nsynth = sizeof(synth) / sizeof(synth[0]);
+
+	for (i = 0; !ret && i < (int)nsynth + argc - 1; i++)
+	{
+		memset(&s, 0, sizeof(s));
+
+		if (i < (int)nsynth) {
+			s.name = synth[i];
+			if (bench_synth(&s, size)) {
+				fprintf(stderr, "Out of memory\n");
+				ret = -4;
+			}
+		}
+		else {
+			s.name = argv[i - nsynth + 1];
+			ret = bench_load(&s);
+		}
+
+		if (!ret)
+			ret = bench_sample(&s, &pool, piece, batch, runs, warmup, csv);
+
+		free(s.data);
+	}
+
+	ctx_pool_destroy(&pool);
+
+	return ret;
+}
@@ -1,3 +1,4 @@
-cl /O2 /EHsc /I.\ lzw-enc.c encoder.c
-cl /O2 /EHsc /I.\ lzw-dec.c decoder.c
+cl /O2 /EHsc /DLZW_WRITEBUF=0 /I.\ lzw-enc.c encoder.c
+cl /O2 /EHsc /DLZW_WRITEBUF=0 /I.\ lzw-dec.c decoder.c
+cl /O2 /EHsc /DLZW_WRITEBUF=0 /I.\ bench.c lzw-enc.obj lzw-dec.obj
 lib /out:lzw.lib lzw-enc.obj lzw-dec.obj
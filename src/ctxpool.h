@@ -0,0 +1,198 @@
+/******************************************************************************
+**  Context pool
+**  --------------------------------------------------------------------------
+**
+**  Thread-safe pool of LZW encoder/decoder contexts for the applications
+**  which encode or decode many short streams. Creating a context clears
+**  its tables, lzw_enc_init/lzw_dec_init of a used context does not touch
+**  them, so the contexts are taken from the pool and put back instead of
+**  lzw_enc_create/lzw_enc_destroy. The last returned context is taken
+**  first, its memory is the most likely to be in the cache.
+**
+**  Author: V.Antonenko
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 2 of the License,
+** or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+** See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along
+** with this program; if not, write to the Free Software Foundation, Inc.
+**
+******************************************************************************/
+#ifndef __CTXPOOL_H__
+#define __CTXPOOL_H__
+
+#include <stdlib.h>
+#include "lzw.h"
+#include "thread.h"
+
+// pool of the contexts with the same code bits, flags and primed dictionary
+typedef struct _ctx_pool
+{
+	mutex_t       lock;
+	unsigned      max_bits;		// number of bits in the maximal code
+	unsigned      flags;		// stream flags
+	const char    *dict;		// primed dictionary or NULL, kept by the caller
+	unsigned      dict_size;	// size of the dictionary
+	unsigned      cap;			// maximal number of idle contexts of each kind
+	lzw_enc_t     **enc;		// stack of idle encoder contexts
+	unsigned      nenc;
+	lzw_dec_t     **dec;		// stack of idle decoder contexts
+	unsigned      ndec;
+}
+ctx_pool_t;
+
+// the dictionary sets the flags of its streams
+__inline static lzw_enc_t *ctx_pool_new_enc(ctx_pool_t *p)
+{
+	lzw_enc_t *ctx = lzw_enc_create(p->max_bits);
+
+	if (ctx) {
+		lzw_enc_flags(ctx, p->flags);
+		if (lzw_enc_dict(ctx, p->dict, p->dict_size)) {
+			lzw_enc_destroy(ctx);
+			ctx = NULL;
+		}
+	}
+
+	return ctx;
+}
+
+__inline static lzw_dec_t *ctx_pool_new_dec(ctx_pool_t *p)
+{
+	lzw_dec_t *ctx = lzw_dec_create(p->max_bits);
+
+	if (ctx) {
+		lzw_dec_flags(ctx, p->flags);
+		if (lzw_dec_dict(ctx, p->dict, p->dict_size)) {
+			lzw_dec_destroy(ctx);
+			ctx = NULL;
+		}
+	}
+
+	return ctx;
+}
+
+// takes an idle encoder context or creates a new one, NULL - out of memory
+// or the primed dictionary does not fit; the sink is the one set by the last
+// user (lzw_enc_sink)
+__inline static lzw_enc_t *ctx_pool_enc(ctx_pool_t *p)
+{
+	lzw_enc_t *ctx = NULL;
+
+	mutex_lock(&p->lock);
+	if (p->nenc)
+		ctx = p->enc[--p->nenc];
+	mutex_unlock(&p->lock);
+
+	return ctx ? ctx : ctx_pool_new_enc(p);
+}
+
+// takes an idle decoder context or creates a new one, NULL - out of memory
+// or the primed dictionary does not fit; the sink is the one set by the last
+// user (lzw_dec_sink)
+__inline static lzw_dec_t *ctx_pool_dec(ctx_pool_t *p)
+{
+	lzw_dec_t *ctx = NULL;
+
+	mutex_lock(&p->lock);
+	if (p->ndec)
+		ctx = p->dec[--p->ndec];
+	mutex_unlock(&p->lock);
+
+	return ctx ? ctx : ctx_pool_new_dec(p);
+}
+
+// puts the encoder context back, the contexts over the capacity are freed
+__inline static void ctx_pool_put_enc(ctx_pool_t *p, lzw_enc_t *ctx)
+{
+	mutex_lock(&p->lock);
+	if (p->nenc < p->cap) {
+		p->enc[p->nenc++] = ctx;
+		ctx = NULL;
+	}
+	mutex_unlock(&p->lock);
+
+	if (ctx)
+		lzw_enc_destroy(ctx);
+}
+
+// puts the decoder context back, the contexts over the capacity are freed
+__inline static void ctx_pool_put_dec(ctx_pool_t *p, lzw_dec_t *ctx)
+{
+	mutex_lock(&p->lock);
+	if (p->ndec < p->cap) {
+		p->dec[p->ndec++] = ctx;
+		ctx = NULL;
+	}
+	mutex_unlock(&p->lock);
+
+	if (ctx)
+		lzw_dec_destroy(ctx);
+}
+
+__inline static void ctx_pool_destroy(ctx_pool_t *p)
+{
+	while (p->nenc)
+		lzw_enc_destroy(p->enc[--p->nenc]);
+	while (p->ndec)
+		lzw_dec_destroy(p->dec[--p->ndec]);
+
+	free(p->enc);
+	free(p->dec);
+	mutex_destroy(&p->lock);
+}
+
+// creates nenc encoder and ndec decoder contexts (up to cap) beforehand,
+// returns 0 or LZW_ERR_MEMORY, LZW_ERR_DICT (the pool is not initialized)
+// if the contexts cannot be created
+__inline static int ctx_pool_init(ctx_pool_t *p, unsigned max_bits, unsigned flags, const char *dict, unsigned dict_size,
+	unsigned cap, unsigned nenc, unsigned ndec)
+{
+	int ret = 0;
+
+	p->max_bits  = max_bits;
+	p->flags     = flags;
+	p->dict      = dict;
+	p->dict_size = dict_size;
+	p->cap       = cap;
+	p->nenc      = 0;
+	p->ndec      = 0;
+	p->enc       = (lzw_enc_t**)malloc((cap ? cap : 1) * sizeof(lzw_enc_t*));
+	p->dec       = (lzw_dec_t**)malloc((cap ? cap : 1) * sizeof(lzw_dec_t*));
+	mutex_init(&p->lock);
+
+	if (!p->enc || !p->dec)
+		ret = LZW_ERR_MEMORY;
+	else if (dict && (dict_size < LZW_DICT_HDR_SIZE || (unsigned char)dict[8] != max_bits))
+		ret = LZW_ERR_DICT;
+
+	for (; !ret && p->nenc < nenc && p->nenc < cap; p->nenc++)
+	{
+		if (!(p->enc[p->nenc] = ctx_pool_new_enc(p))) {
+			ret = dict ? LZW_ERR_DICT : LZW_ERR_MEMORY;
+			break;
+		}
+	}
+
+	for (; !ret && p->ndec < ndec && p->ndec < cap; p->ndec++)
+	{
+		if (!(p->dec[p->ndec] = ctx_pool_new_dec(p))) {
+			ret = dict ? LZW_ERR_DICT : LZW_ERR_MEMORY;
+			break;
+		}
+	}
+
+	if (ret)
+		ctx_pool_destroy(p);
+
+	return ret;
+}
+
+#endif //__CTXPOOL_H__
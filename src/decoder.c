@@ -2,27 +2,493 @@
 #include <stdio.h>
 #include <memory.h>
 #include "lzw.h"
+#include "thread.h"
+#include "fmap.h"
+#include "pipe.h"
 
-void lzw_writebuf(void *stream, char *buf, unsigned size)
+// maximal number of mapped bytes passed to lzw_decode at once
+#define MAP_CHUNK	(1u << 30)
+
+// output stream: a file, an output pipe or a growing memory buffer
+typedef struct _stream
+{
+	FILE          *file;	// output file, NULL for memory stream
+	pipe_t        *pipe;	// output pipe or NULL
+	char          *buf;		// memory buffer
+	unsigned      size;		// number of bytes in the buffer
+	unsigned      cap;		// buffer capacity
+}
+stream_t;
+
+// block of the framed stream
+typedef struct _block
 {
-	fwrite(buf, size, 1, (FILE*)stream);
+	char          *in;		// block codes
+	unsigned      cap;		// size of the codes buffer
+	unsigned      csize;	// number of code bytes
+	unsigned      usize;	// expected number of uncompressed bytes
+	int           stored;	// the codes are the uncompressed bytes
+	stream_t      out;		// uncompressed data
+	int           err;		// decoding error code
+	int           done;		// block is decoded
 }
+block_t;
 
-unsigned lzw_readbuf(void *stream, char *buf, unsigned size)
+// decoder thread pool
+typedef struct _pool
+{
+	mutex_t       lock;
+	cond_t        job;		// signaled when a block is queued
+	cond_t        done;		// signaled when a block is decoded
+	block_t       *blocks;	// ring of blocks (reorder buffer)
+	unsigned      nblocks;	// number of blocks in the ring
+	unsigned      head;		// sequence number of the next block to decode
+	unsigned      tail;		// sequence number of the next block to queue
+	int           quit;		// no more blocks
+}
+pool_t;
+
+// decoder thread
+typedef struct _worker
+{
+	pool_t        *pool;
+	lzw_dec_t     *ctx;		// private decoder context
+	thread_t      thread;
+}
+worker_t;
+
+static void stream_write(void *stream, char *buf, unsigned size)
+{
+	stream_t *s = (stream_t*)stream;
+
+	if (s->pipe) {
+		pipe_write(s->pipe, buf, size);
+		return;
+	}
+
+	if (s->file) {
+		fwrite(buf, size, 1, s->file);
+		return;
+	}
+
+	if (s->size + size > s->cap)
+	{
+		unsigned cap = s->cap ? s->cap : 4096;
+		char     *p;
+
+		while (cap < s->size + size)
+			cap *= 2;
+
+		if (!(p = (char*)realloc(s->buf, cap))) {
+			fprintf(stderr, "Out of memory\n");
+			exit(-4);
+		}
+
+		s->buf = p;
+		s->cap = cap;
+	}
+
+	memcpy(s->buf + s->size, buf, size);
+	s->size += size;
+}
+
+static unsigned file_read(void *stream, char *buf, unsigned size)
 {
 	return fread(buf, 1, size, (FILE*)stream);
 }
 
+/******************************************************************************
+**  read_all
+**  --------------------------------------------------------------------------
+**  Reads the rest of the file into memory.
+**
+**  Arguments:
+**      f    - input file;
+**      size - output: number of bytes;
+**
+**  Return: the bytes (freed by free) or NULL if the file is empty
+******************************************************************************/
+static char *read_all(FILE *f, unsigned *size)
+{
+	stream_t s;
+	char     buf[0x10000];
+	unsigned len;
+
+	memset(&s, 0, sizeof(s));
 
-// global object
-lzw_dec_t lzw;
+	while (len = file_read(f, buf, sizeof(buf)))
+		stream_write(&s, buf, len);
+
+	*size = s.size;
+	return s.buf;
+}
+
+/******************************************************************************
+**  dec_worker
+**  --------------------------------------------------------------------------
+**  Decoder thread. Takes queued blocks in order and decodes every block
+**  with a fresh dictionary into the block's memory stream. The stored
+**  blocks are written from the input.
+**
+**  Arguments:
+**      arg - pointer to worker_t;
+**
+**  Return: -
+******************************************************************************/
+static THREAD_PROC(dec_worker, arg)
+{
+	worker_t *w    = (worker_t*)arg;
+	pool_t   *pool = w->pool;
+
+	for (;;)
+	{
+		block_t *b;
+		int     ret;
+
+		mutex_lock(&pool->lock);
+		while (pool->head == pool->tail && !pool->quit)
+			cond_wait(&pool->job, &pool->lock);
+
+		if (pool->head == pool->tail) {
+			mutex_unlock(&pool->lock);
+			break;
+		}
+
+		b = &pool->blocks[pool->head++ % pool->nblocks];
+		mutex_unlock(&pool->lock);
+
+		b->out.size = 0;
+		ret         = 0;
+
+		if (!b->stored)
+		{
+			lzw_dec_init(w->ctx, &b->out);
+
+			if ((ret = lzw_decode(w->ctx, b->in, b->csize)) >= 0)
+				ret = (ret == b->csize && b->out.size == b->usize) ? 0 : LZW_ERR_FRAME;
+		}
+
+		mutex_lock(&pool->lock);
+		b->err  = ret;
+		b->done = 1;
+		cond_broadcast(&pool->done);
+		mutex_unlock(&pool->lock);
+	}
+
+	THREAD_RETURN;
+}
+
+/******************************************************************************
+**  write_block
+**  --------------------------------------------------------------------------
+**  Waits until the block is decoded and writes it into the output file.
+**  The ring of blocks works as a reorder buffer: blocks are written
+**  in stream order regardless of the order they are decoded in.
+**
+**  Arguments:
+**      pool - thread pool;
+**      b    - block;
+**      fout - output file;
+**
+**  Return: error code
+******************************************************************************/
+static int write_block(pool_t *pool, block_t *b, FILE *fout)
+{
+	mutex_lock(&pool->lock);
+	while (!b->done)
+		cond_wait(&pool->done, &pool->lock);
+	mutex_unlock(&pool->lock);
+
+	if (b->err) {
+		fprintf(stderr, "Error %d\n", b->err);
+		return b->err;
+	}
+
+	if (b->stored)
+		fwrite(b->in, b->csize, 1, fout);
+	else
+		fwrite(b->out.buf, b->out.size, 1, fout);
+
+	return 0;
+}
+
+/******************************************************************************
+**  read_block
+**  --------------------------------------------------------------------------
+**  Reads the block header and the block codes from the input file.
+**  The codes of the mapped input are not copied.
+**
+**  Arguments:
+**      b          - block;
+**      fin        - input file;
+**      map        - mapped input file or NULL;
+**      pos        - position in the mapped input file;
+**      block_size - maximal uncompressed block size;
+**
+**  Return: 1 if the block is read, 0 at the end of the frame or error code
+******************************************************************************/
+static int read_block(block_t *b, FILE *fin, const fmap_t *map, unsigned long long *pos, unsigned block_size)
+{
+	char hdr[LZW_BLOCK_HDR_SIZE];
+
+	if (map)
+	{
+		if (map->size - *pos < sizeof(hdr)) {
+			fprintf(stderr, "Unexpected end of stream\n");
+			return -5;
+		}
+
+		memcpy(hdr, map->data + *pos, sizeof(hdr));
+		*pos += sizeof(hdr);
+	}
+	else if (file_read(fin, hdr, sizeof(hdr)) != sizeof(hdr)) {
+		fprintf(stderr, "Unexpected end of stream\n");
+		return -5;
+	}
+
+	b->stored = lzw_dec_block_hdr(hdr, &b->csize, &b->usize);
+
+	// end of the frame
+	if (!b->csize)
+		return 0;
+
+	if (b->usize > block_size || (b->stored && b->csize != b->usize)) {
+		fprintf(stderr, "Wrong block size\n");
+		return LZW_ERR_FRAME;
+	}
+
+	if (map)
+	{
+		if (map->size - *pos < b->csize) {
+			fprintf(stderr, "Unexpected end of stream\n");
+			return -5;
+		}
+
+		b->in = map->data + *pos;
+		*pos += b->csize;
+		return 1;
+	}
+
+	if (b->csize > b->cap)
+	{
+		free(b->in);
+		if (!(b->in = (char*)malloc(b->cap = b->csize))) {
+			fprintf(stderr, "Out of memory\n");
+			b->cap = 0;
+			return -4;
+		}
+	}
+
+	if (file_read(fin, b->in, b->csize) != b->csize) {
+		fprintf(stderr, "Unexpected end of stream\n");
+		return -5;
+	}
+
+	return 1;
+}
+
+/******************************************************************************
+**  decode_framed
+**  --------------------------------------------------------------------------
+**  Decodes blocks of the framed stream in parallel.
+**  The frame header and the dictionary ID are already read.
+**
+**  Arguments:
+**      fin        - input file;
+**      map        - mapped input file or NULL;
+**      fout       - output file;
+**      pos        - offset of the first block;
+**      block_size - maximal uncompressed block size;
+**      max_bits   - number of bits in the maximal code;
+**      flags      - stream flags;
+**      dict       - primed dictionary or NULL;
+**      dict_size  - size of the dictionary;
+**      nthreads   - number of decoder threads;
+**
+**  Return: error code
+******************************************************************************/
+static int decode_framed(FILE *fin, const fmap_t *map, FILE *fout, unsigned long long pos, unsigned block_size, unsigned max_bits, unsigned flags, const char *dict, unsigned dict_size, unsigned nthreads)
+{
+	pool_t    pool;
+	worker_t  *workers;
+	unsigned  seq, i;
+	int       ret = 0;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.nblocks = nthreads * 2;
+	pool.blocks  = (block_t*)calloc(pool.nblocks, sizeof(block_t));
+	workers      = (worker_t*)calloc(nthreads, sizeof(worker_t));
+
+	if (!pool.blocks || !workers) {
+		fprintf(stderr, "Out of memory\n");
+		return -4;
+	}
+
+	mutex_init(&pool.lock);
+	cond_init(&pool.job);
+	cond_init(&pool.done);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		workers[i].pool = &pool;
+
+		if (!(workers[i].ctx = lzw_dec_create(max_bits))) {
+			fprintf(stderr, "Out of memory\n");
+			return -4;
+		}
+
+		lzw_dec_sink(workers[i].ctx, stream_write);
+		lzw_dec_flags(workers[i].ctx, flags);
+
+		if (lzw_dec_dict(workers[i].ctx, dict, dict_size)) {
+			fprintf(stderr, "Wrong dictionary\n");
+			return LZW_ERR_DICT;
+		}
+
+		if (thread_create(&workers[i].thread, dec_worker, &workers[i])) {
+			fprintf(stderr, "Cannot create thread\n");
+			return -5;
+		}
+	}
+
+	for (seq = 0;; seq++)
+	{
+		block_t *b = &pool.blocks[seq % pool.nblocks];
+
+		// the ring is full - the oldest block should be written first
+		if (seq >= pool.nblocks && (ret = write_block(&pool, b, fout)))
+			break;
+
+		if ((ret = read_block(b, fin, map, &pos, block_size)) <= 0)
+			break;
+
+		mutex_lock(&pool.lock);
+		b->done = 0;
+		pool.tail++;
+		cond_signal(&pool.job);
+		mutex_unlock(&pool.lock);
+	}
+
+	// write the rest of the blocks
+	for (i = seq < pool.nblocks ? 0 : seq - pool.nblocks + 1; !ret && i < seq; i++)
+		ret = write_block(&pool, &pool.blocks[i % pool.nblocks], fout);
+
+	mutex_lock(&pool.lock);
+	pool.quit = 1;
+	cond_broadcast(&pool.job);
+	mutex_unlock(&pool.lock);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		thread_join(workers[i].thread);
+		lzw_dec_destroy(workers[i].ctx);
+	}
+
+	for (i = 0; i < pool.nblocks; i++)
+	{
+		if (!map)
+			free(pool.blocks[i].in);
+		free(pool.blocks[i].out.buf);
+	}
+
+	cond_destroy(&pool.done);
+	cond_destroy(&pool.job);
+	mutex_destroy(&pool.lock);
+	free(workers);
+	free(pool.blocks);
+
+	return ret;
+}
+
+/******************************************************************************
+**  decode_range
+**  --------------------------------------------------------------------------
+**  Decodes the byte range of the mapped framed stream, only the blocks
+**  covering the range are read (lzw_dec_range).
+**
+**  Arguments:
+**      map       - mapped input file;
+**      fout      - output file;
+**      max_bits  - number of bits in the maximal code;
+**      flags     - stream flags;
+**      dict      - primed dictionary or NULL;
+**      dict_size - size of the dictionary;
+**      offset    - uncompressed offset of the range or of its end;
+**      len       - length of the range;
+**      tail      - the offset is counted from the end of the stream;
+**
+**  Return: error code
+******************************************************************************/
+static int decode_range(const fmap_t *map, FILE *fout, unsigned max_bits, unsigned flags, const char *dict, unsigned dict_size, unsigned long long offset, unsigned long long len, int tail)
+{
+	lzw_dec_t  *ctx;
+	stream_t   out;
+	const char *index;
+	unsigned   nblocks;
+	int        ret;
+
+	// the size of the stream is the offset of the end of the frame
+	if (tail)
+	{
+		unsigned long long coffset, size;
+
+		if (!(index = lzw_dec_index(map->data, map->size, &nblocks))) {
+			fprintf(stderr, "No block index\n");
+			return LZW_ERR_FRAME;
+		}
+
+		lzw_dec_index_entry(index + nblocks * LZW_INDEX_ENTRY_SIZE, &coffset, &size);
+		offset = offset < size ? size - offset : 0;
+	}
+
+	if (!(ctx = lzw_dec_create(max_bits))) {
+		fprintf(stderr, "Out of memory\n");
+		return -4;
+	}
+
+	lzw_dec_sink(ctx, stream_write);
+	lzw_dec_flags(ctx, flags);
+
+	if (lzw_dec_dict(ctx, dict, dict_size)) {
+		fprintf(stderr, "Wrong dictionary\n");
+		lzw_dec_destroy(ctx);
+		return LZW_ERR_DICT;
+	}
+
+	memset(&out, 0, sizeof(out));
+	out.file = fout;
+
+	if (ret = lzw_dec_range(ctx, &out, map->data, map->size, offset, len))
+		fprintf(stderr, "Error %d\n", ret);
+
+	lzw_dec_destroy(ctx);
+
+	return ret;
+}
 
 /******************************************************************************
 **  main
 **  --------------------------------------------------------------------------
 **  Decodes input LZW code stream into byte stream.
-**  
+**  Framed streams are detected by the frame header, Unix compress (.Z)
+**  files are detected by the magic if no dialect is set.
+**  Regular input files are mapped into memory, other files are read
+**  by the buffered I/O. The pipelined raw stream is read ahead and
+**  written by separate threads.
+**
 **  Arguments:
+**      -m      - number of bits in the maximal code for raw stream;
+**      -c      - CLEAR code is used in raw stream;
+**      -G      - GIF dialect of the raw stream;
+**      -T      - TIFF dialect of the raw stream;
+**      -S      - SYNC code is used in raw stream;
+**      -D      - primed dictionary file, its code bits and flags are used
+**                for raw stream;
+**      -p      - read the input and write the output of raw stream
+**                by separate threads;
+**      -t      - number of threads for framed stream;
+**      -r      - [-]offset[:length] of the range of framed stream,
+**                the negative offset is counted from the end;
 **      argv[1] - input file name;
 **      argv[2] - output file name;
 **
@@ -32,12 +498,93 @@ int main (int argc, char* argv[])
 {
 	FILE       *fin;
 	FILE       *fout;
-	lzw_dec_t  *ctx = &lzw;
+	lzw_dec_t  *ctx;
+	stream_t   out;
+	pipe_t     pipe;
+	pipe_t     in;
+	fmap_t     map;
+	int        mapped;
+	int        piped;
+	char       *hdr;
 	unsigned   len;
-	char       buf[256];
+	unsigned   block_size;
+	char       buf[0x10000];
+	unsigned   nthreads = 0;
+	unsigned   max_bits = 0;
+	unsigned   flags    = 0;
+	unsigned   start    = 0;
+	int        pipelined = 0;
+	int        range     = 0;
+	int        tail      = 0;
+	unsigned long long offset = 0;
+	unsigned long long length = ~0ull;
+	char       *dict    = NULL;
+	unsigned   dict_size = 0;
+	int        ret      = 0;
+
+	while (argc > 3 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'c' || argv[1][1] == 'G' || argv[1][1] == 'T' || argv[1][1] == 'S' || argv[1][1] == 'p') {
+			if (argv[1][1] == 'c')
+				flags |= LZW_FLAG_CLEAR;
+			else if (argv[1][1] == 'G')
+				flags = LZW_DIALECT_GIF;
+			else if (argv[1][1] == 'T')
+				flags = LZW_DIALECT_TIFF;
+			else if (argv[1][1] == 'S')
+				flags |= LZW_FLAG_SYNC;
+			else
+				pipelined = 1;
+			argc--;
+			argv++;
+			continue;
+		}
+		else if (argv[1][1] == 't')
+			nthreads = atoi(argv[2]);
+		else if (argv[1][1] == 'r')
+		{
+			char *end;
+
+			range  = 1;
+			tail   = argv[2][0] == '-';
+			offset = strtoull(argv[2] + tail, &end, 10);
+			if (*end == ':')
+				length = strtoull(end + 1, NULL, 10);
+		}
+		else if (argv[1][1] == 'm')
+			max_bits = atoi(argv[2]);
+		else if (argv[1][1] == 'D')
+		{
+			FILE *f = fopen(argv[2], "rb");
+
+			if (!f || !(dict = read_all(f, &dict_size)) || dict_size < LZW_DICT_HDR_SIZE) {
+				fprintf(stderr, "Cannot read dictionary %s\n", argv[2]);
+				return -2;
+			}
+			fclose(f);
+
+			// the raw stream is decoded as the dictionary was trained
+			max_bits = (unsigned char)dict[8];
+			flags    = (unsigned char)dict[9];
+		}
+		else
+			break;
+
+		argc -= 2;
+		argv += 2;
+	}
 
 	if (argc < 3) {
-		printf("Usage: lzw-dec <input file> <output file>\n");
+		printf("Usage: lzw-dec [-m <max code bits>] [-c | -G | -T] [-S] [-D <dictionary>] [-p] [-t <threads>] [-r [-]<offset>[:<length>]] <input file> <output file>\n");
+		return -1;
+	}
+
+	// GIF and TIFF codes are up to 12 bits
+	if (!max_bits)
+		max_bits = flags & LZW_FLAG_EOI ? 12 : DICT_BITS;
+
+	if (max_bits < DICT_BITS_MIN || max_bits > DICT_BITS_MAX) {
+		fprintf(stderr, "Max code bits should be %d..%d\n", DICT_BITS_MIN, DICT_BITS_MAX);
 		return -1;
 	}
 
@@ -51,21 +598,144 @@ int main (int argc, char* argv[])
 		return -3;
 	}
 
-	lzw_dec_init(ctx, fout);
+	// the page faults of the mapped input would stall the decoder
+	mapped = !pipelined && !fmap_open(&map, fin);
+
+	if (mapped)
+	{
+		hdr = map.data;
+		len = map.size < LZW_FRAME_HDR_SIZE ? (unsigned)map.size : LZW_FRAME_HDR_SIZE;
+	}
+	else
+	{
+		hdr = buf;
+		len = file_read(fin, buf, LZW_FRAME_HDR_SIZE);
+	}
 
-	while (len = lzw_readbuf(fin, buf, sizeof(buf)))
+	if (len == LZW_FRAME_HDR_SIZE && !memcmp(hdr, LZW_FRAME_MAGIC, 4))
 	{
-		int ret = lzw_decode(ctx, buf, len);
+		start = LZW_FRAME_HDR_SIZE;
 
-		if (ret != len)
+		if (lzw_dec_frame_hdr(hdr, &block_size, &max_bits, &flags) < 0) {
+			fprintf(stderr, "Unsupported stream format\n");
+			ret = LZW_ERR_FRAME;
+		}
+		// the ID of the primed dictionary follows the header
+		else if ((hdr[7] & LZW_FRAME_DICT) &&
+			((mapped ? map.size < LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE :
+				file_read(fin, buf + LZW_FRAME_HDR_SIZE, LZW_FRAME_DICT_SIZE) != LZW_FRAME_DICT_SIZE) ||
+			(start += LZW_FRAME_DICT_SIZE, lzw_dec_frame_dict(hdr, dict))))
 		{
-			fprintf(stderr, "Error %d\n", ret);
-			break;
+			fprintf(stderr, "Wrong dictionary\n");
+			ret = LZW_ERR_DICT;
 		}
+		else if (range && !mapped)
+		{
+			fprintf(stderr, "Range needs a regular input file\n");
+			ret = -2;
+		}
+		else if (range)
+			ret = decode_range(&map, fout, max_bits, flags, hdr[7] & LZW_FRAME_DICT ? dict : NULL, dict_size, offset, length, tail);
+		else
+			ret = decode_framed(fin, mapped ? &map : NULL, fout, start, block_size, max_bits, flags,
+				hdr[7] & LZW_FRAME_DICT ? dict : NULL, dict_size, nthreads ? nthreads : cpu_count());
+	}
+	else if (range)
+	{
+		fprintf(stderr, "Range needs a framed stream\n");
+		ret = LZW_ERR_FRAME;
+	}
+	// raw streams never start with the magic of .Z file
+	else if (!flags && !dict && len >= LZW_Z_HDR_SIZE && !memcmp(hdr, LZW_Z_MAGIC, 2) &&
+		(start = LZW_Z_HDR_SIZE, lzw_dec_z_hdr(hdr, &max_bits, &flags) < 0))
+	{
+		fprintf(stderr, "Unsupported stream format\n");
+		ret = LZW_ERR_FRAME;
+	}
+	else if (!(ctx = lzw_dec_create(max_bits)))
+	{
+		fprintf(stderr, "Out of memory\n");
+		ret = -4;
+	}
+	else if (lzw_dec_dict(ctx, dict, dict_size))
+	{
+		fprintf(stderr, "Wrong dictionary\n");
+		lzw_dec_destroy(ctx);
+		ret = LZW_ERR_DICT;
+	}
+	else
+	{
+		memset(&out, 0, sizeof(out));
+		out.file = fout;
+
+		// the output is written while the next codes are decoded
+		if (pipelined && !pipe_open(&pipe, fout, 0))
+			out.pipe = &pipe;
+
+		// the dictionary sets the flags of its streams
+		if (!dict)
+			lzw_dec_flags(ctx, flags);
+		lzw_dec_sink(ctx, stream_write);
+		lzw_dec_init(ctx, &out);
+
+		if (mapped)
+		{
+			unsigned long long pos;
+
+			for (pos = start; pos < map.size; pos += len)
+			{
+				len = map.size - pos < MAP_CHUNK ? (unsigned)(map.size - pos) : MAP_CHUNK;
+				ret = lzw_decode(ctx, map.data + pos, len);
+
+				// the rest of the input after EOI code is ignored
+				if (ret != len && !(ret >= 0 && (flags & LZW_FLAG_EOI)))
+				{
+					fprintf(stderr, "Error %d\n", ret);
+					break;
+				}
+
+				ret = 0;
+			}
+		}
+		// raw stream, the first bytes are already read,
+		// the next input chunks are read while the current one is decoded
+		else
+		{
+			char *chunk = buf + start;
+
+			piped = pipelined && !pipe_open(&in, fin, 1);
+			len  -= start;
+
+			do
+			{
+				ret = lzw_decode(ctx, chunk, len);
+
+				if (ret != len && !(ret >= 0 && (flags & LZW_FLAG_EOI)))
+				{
+					fprintf(stderr, "Error %d\n", ret);
+					break;
+				}
+
+				ret = 0;
+			}
+			while (piped ? (len = pipe_read(&in, &chunk)) : (chunk = buf, len = file_read(fin, buf, sizeof(buf))));
+
+			if (piped)
+				pipe_close(&in, 1);
+		}
+
+		if (out.pipe)
+			pipe_close(out.pipe, 0);
+
+		lzw_dec_destroy(ctx);
 	}
 
+	if (mapped)
+		fmap_close(&map);
+
 	fclose(fin);
 	fclose(fout);
+	free(dict);
 
-	return 0;
-}
\ No newline at end of file
+	return ret;
+}
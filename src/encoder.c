@@ -2,26 +2,427 @@
 #include <stdio.h>
 #include <memory.h>
 #include "lzw.h"
+#include "thread.h"
+#include "fmap.h"
+#include "pipe.h"
 
-void lzw_writebuf(void *stream, char *buf, unsigned size)
+// maximal number of mapped bytes passed to lzw_encode at once
+#define MAP_CHUNK	(1u << 30)
+
+// the block is encoded by slices, the block which codes run ahead
+// of its bytes after a slice is stored
+#define STORE_SLICE	(1u << 16)
+
+// output stream: a file, an output pipe or a growing memory buffer
+typedef struct _stream
+{
+	FILE          *file;	// output file, NULL for memory stream
+	pipe_t        *pipe;	// output pipe or NULL
+	char          *buf;		// memory buffer
+	unsigned      size;		// number of bytes in the buffer
+	unsigned      cap;		// buffer capacity
+}
+stream_t;
+
+// block of the framed stream
+typedef struct _block
+{
+	char          *in;		// uncompressed data
+	unsigned      len;		// number of uncompressed bytes
+	stream_t      out;		// block codes
+	int           stored;	// block does not compress, it is stored
+	int           done;		// block is encoded
+}
+block_t;
+
+// block index of the framed stream
+typedef struct _index
+{
+	stream_t           entries;	// index entries
+	unsigned long long coffset;	// offset of the next block header from the frame header
+	unsigned long long uoffset;	// uncompressed offset of the next block
+	unsigned           nblocks;
+}
+index_t;
+
+// encoder thread pool
+typedef struct _pool
 {
-	fwrite(buf, size, 1, (FILE*)stream);
+	mutex_t       lock;
+	cond_t        job;		// signaled when a block is queued
+	cond_t        done;		// signaled when a block is encoded
+	block_t       *blocks;	// ring of blocks
+	unsigned      nblocks;	// number of blocks in the ring
+	unsigned      head;		// sequence number of the next block to encode
+	unsigned      tail;		// sequence number of the next block to queue
+	int           quit;		// no more blocks
 }
+pool_t;
 
-unsigned lzw_readbuf(void *stream, char *buf, unsigned size)
+// encoder thread
+typedef struct _worker
+{
+	pool_t        *pool;
+	lzw_enc_t     *ctx;		// private encoder context
+	thread_t      thread;
+}
+worker_t;
+
+static void stream_write(void *stream, char *buf, unsigned size)
+{
+	stream_t *s = (stream_t*)stream;
+
+	if (s->pipe) {
+		pipe_write(s->pipe, buf, size);
+		return;
+	}
+
+	if (s->file) {
+		fwrite(buf, size, 1, s->file);
+		return;
+	}
+
+	if (s->size + size > s->cap)
+	{
+		unsigned cap = s->cap ? s->cap : 4096;
+		char     *p;
+
+		while (cap < s->size + size)
+			cap *= 2;
+
+		if (!(p = (char*)realloc(s->buf, cap))) {
+			fprintf(stderr, "Out of memory\n");
+			exit(-4);
+		}
+
+		s->buf = p;
+		s->cap = cap;
+	}
+
+	memcpy(s->buf + s->size, buf, size);
+	s->size += size;
+}
+
+static unsigned file_read(void *stream, char *buf, unsigned size)
 {
 	return fread(buf, 1, size, (FILE*)stream);
 }
 
-// global object
-lzw_enc_t lzw;
+/******************************************************************************
+**  read_all
+**  --------------------------------------------------------------------------
+**  Reads the rest of the file into memory.
+**
+**  Arguments:
+**      f    - input file;
+**      size - output: number of bytes;
+**
+**  Return: the bytes (freed by free) or NULL if the file is empty
+******************************************************************************/
+static char *read_all(FILE *f, unsigned *size)
+{
+	stream_t s;
+	char     buf[0x10000];
+	unsigned len;
+
+	memset(&s, 0, sizeof(s));
+
+	while (len = file_read(f, buf, sizeof(buf)))
+		stream_write(&s, buf, len);
+
+	*size = s.size;
+	return s.buf;
+}
+
+/******************************************************************************
+**  enc_worker
+**  --------------------------------------------------------------------------
+**  Encoder thread. Takes queued blocks in order and encodes every block
+**  with a fresh dictionary into the block's memory stream. The encoding
+**  of the block which codes are longer than its bytes is abandoned,
+**  the block is stored.
+**
+**  Arguments:
+**      arg - pointer to worker_t;
+**
+**  Return: -
+******************************************************************************/
+static THREAD_PROC(enc_worker, arg)
+{
+	worker_t *w    = (worker_t*)arg;
+	pool_t   *pool = w->pool;
+
+	for (;;)
+	{
+		block_t  *b;
+		unsigned pos, n;
+
+		mutex_lock(&pool->lock);
+		while (pool->head == pool->tail && !pool->quit)
+			cond_wait(&pool->job, &pool->lock);
+
+		if (pool->head == pool->tail) {
+			mutex_unlock(&pool->lock);
+			break;
+		}
+
+		b = &pool->blocks[pool->head++ % pool->nblocks];
+		mutex_unlock(&pool->lock);
+
+		b->out.size = 0;
+		b->stored   = 0;
+		lzw_enc_init(w->ctx, &b->out);
+
+		for (pos = 0; pos < b->len && !b->stored; pos += n)
+		{
+			n = b->len - pos < STORE_SLICE ? b->len - pos : STORE_SLICE;
+			lzw_encode(w->ctx, b->in + pos, n);
+			b->stored = b->out.size > pos + n;
+		}
+
+		if (!b->stored) {
+			lzw_enc_end(w->ctx);
+			b->stored = b->out.size >= b->len;
+		}
+
+		mutex_lock(&pool->lock);
+		b->done = 1;
+		cond_broadcast(&pool->done);
+		mutex_unlock(&pool->lock);
+	}
+
+	THREAD_RETURN;
+}
+
+/******************************************************************************
+**  write_block
+**  --------------------------------------------------------------------------
+**  Waits until the block is encoded and writes it into the output file.
+**  The stored block is written as is.
+**
+**  Arguments:
+**      pool  - thread pool;
+**      b     - block;
+**      fout  - output file;
+**      index - block index or NULL;
+**
+**  Return: -
+******************************************************************************/
+static void write_block(pool_t *pool, block_t *b, FILE *fout, index_t *index)
+{
+	char hdr[LZW_BLOCK_HDR_SIZE];
+	char entry[LZW_INDEX_ENTRY_SIZE];
+
+	mutex_lock(&pool->lock);
+	while (!b->done)
+		cond_wait(&pool->done, &pool->lock);
+	mutex_unlock(&pool->lock);
+
+	if (b->stored) {
+		lzw_enc_block_hdr(hdr, b->len | LZW_BLOCK_STORED, b->len);
+		fwrite(hdr, sizeof(hdr), 1, fout);
+		fwrite(b->in, b->len, 1, fout);
+	}
+	else {
+		lzw_enc_block_hdr(hdr, b->out.size, b->len);
+		fwrite(hdr, sizeof(hdr), 1, fout);
+		fwrite(b->out.buf, b->out.size, 1, fout);
+	}
+
+	if (index)
+	{
+		lzw_enc_index_entry(entry, index->coffset, index->uoffset);
+		stream_write(&index->entries, entry, sizeof(entry));
+		index->coffset += sizeof(hdr) + (b->stored ? b->len : b->out.size);
+		index->uoffset += b->len;
+		index->nblocks++;
+	}
+}
+
+/******************************************************************************
+**  encode_framed
+**  --------------------------------------------------------------------------
+**  Splits input into blocks, encodes them in parallel and writes
+**  the framed stream. Blocks are written in input order.
+**  The blocks of the mapped input are encoded in place.
+**  The block index follows the end of the indexed frame.
+**
+**  Arguments:
+**      fin        - input file;
+**      map        - mapped input file or NULL;
+**      fout       - output file;
+**      block_size - number of input bytes in a block;
+**      max_bits   - number of bits in the maximal code;
+**      flags      - stream flags;
+**      dict       - primed dictionary or NULL;
+**      dict_size  - size of the dictionary;
+**      indexed    - write the block index;
+**      nthreads   - number of encoder threads;
+**
+**  Return: error code
+******************************************************************************/
+static int encode_framed(FILE *fin, const fmap_t *map, FILE *fout, unsigned block_size, unsigned max_bits, unsigned flags, const char *dict, unsigned dict_size, int indexed, unsigned nthreads)
+{
+	pool_t    pool;
+	worker_t  *workers;
+	index_t   index;
+	char      hdr[LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE];
+	unsigned long long pos = 0;
+	unsigned  seq, i;
+
+	memset(&pool, 0, sizeof(pool));
+	memset(&index, 0, sizeof(index));
+	pool.nblocks = nthreads * 2;
+	pool.blocks  = (block_t*)calloc(pool.nblocks, sizeof(block_t));
+	workers      = (worker_t*)calloc(nthreads, sizeof(worker_t));
+
+	if (!pool.blocks || !workers) {
+		fprintf(stderr, "Out of memory\n");
+		return -4;
+	}
+
+	for (i = 0; !map && i < pool.nblocks; i++)
+	{
+		if (!(pool.blocks[i].in = (char*)malloc(block_size))) {
+			fprintf(stderr, "Out of memory\n");
+			return -4;
+		}
+	}
+
+	mutex_init(&pool.lock);
+	cond_init(&pool.job);
+	cond_init(&pool.done);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		workers[i].pool = &pool;
+
+		if (!(workers[i].ctx = lzw_enc_create(max_bits))) {
+			fprintf(stderr, "Out of memory\n");
+			return -4;
+		}
+
+		lzw_enc_sink(workers[i].ctx, stream_write);
+		lzw_enc_flags(workers[i].ctx, flags);
+		// all the contexts share the dictionary
+		if (lzw_enc_dict(workers[i].ctx, dict, dict_size)) {
+			fprintf(stderr, "Wrong dictionary\n");
+			return LZW_ERR_DICT;
+		}
+
+		if (thread_create(&workers[i].thread, enc_worker, &workers[i])) {
+			fprintf(stderr, "Cannot create thread\n");
+			return -5;
+		}
+	}
+
+	lzw_enc_frame_hdr(hdr, block_size, max_bits, flags);
+	hdr[7] |= LZW_FRAME_STORED;
+	if (dict)
+		lzw_enc_frame_dict(hdr, dict);
+	if (indexed)
+		hdr[7] |= LZW_FRAME_INDEX;
+	index.coffset = dict ? sizeof(hdr) : LZW_FRAME_HDR_SIZE;
+	fwrite(hdr, (unsigned)index.coffset, 1, fout);
+
+	for (seq = 0;; seq++)
+	{
+		block_t *b = &pool.blocks[seq % pool.nblocks];
+
+		// the ring is full - the oldest block should be written first
+		if (seq >= pool.nblocks)
+			write_block(&pool, b, fout, indexed ? &index : NULL);
+
+		if (map)
+		{
+			b->in  = map->data + pos;
+			b->len = map->size - pos < block_size ? (unsigned)(map->size - pos) : block_size;
+			pos   += b->len;
+		}
+		else
+			b->len = file_read(fin, b->in, block_size);
+
+		if (!b->len)
+			break;
+
+		mutex_lock(&pool.lock);
+		b->done = 0;
+		pool.tail++;
+		cond_signal(&pool.job);
+		mutex_unlock(&pool.lock);
+	}
+
+	// write the rest of the blocks
+	for (i = seq < pool.nblocks ? 0 : seq - pool.nblocks + 1; i < seq; i++)
+		write_block(&pool, &pool.blocks[i % pool.nblocks], fout, indexed ? &index : NULL);
+
+	// end of the frame
+	lzw_enc_block_hdr(hdr, 0, 0);
+	fwrite(hdr, LZW_BLOCK_HDR_SIZE, 1, fout);
+
+	// the index: the entries of the blocks and the end of the frame, the trailer
+	if (indexed)
+	{
+		lzw_enc_index_entry(hdr, index.coffset, index.uoffset);
+		stream_write(&index.entries, hdr, LZW_INDEX_ENTRY_SIZE);
+		fwrite(index.entries.buf, index.entries.size, 1, fout);
+
+		lzw_enc_index_trailer(hdr, index.nblocks);
+		fwrite(hdr, LZW_INDEX_TRAILER_SIZE, 1, fout);
+		free(index.entries.buf);
+	}
+
+	mutex_lock(&pool.lock);
+	pool.quit = 1;
+	cond_broadcast(&pool.job);
+	mutex_unlock(&pool.lock);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		thread_join(workers[i].thread);
+		lzw_enc_destroy(workers[i].ctx);
+	}
+
+	for (i = 0; i < pool.nblocks; i++)
+	{
+		if (!map)
+			free(pool.blocks[i].in);
+		free(pool.blocks[i].out.buf);
+	}
+
+	cond_destroy(&pool.done);
+	cond_destroy(&pool.job);
+	mutex_destroy(&pool.lock);
+	free(workers);
+	free(pool.blocks);
+
+	return 0;
+}
 
 /******************************************************************************
 **  main
 **  --------------------------------------------------------------------------
 **  Encodes input byte stream into LZW code stream.
-**  
+**  Regular input files are mapped into memory, other files are read
+**  by the buffered I/O. The pipelined raw stream is read ahead and
+**  written by separate threads.
+**
 **  Arguments:
+**      -m      - number of bits in the maximal code;
+**      -c      - adaptive dictionary reset by CLEAR code;
+**      -Z      - Unix compress (.Z) file;
+**      -G      - GIF dialect of the raw stream;
+**      -T      - TIFF dialect of the raw stream;
+**      -S      - SYNC code after every read of the input which is not
+**                mapped (lzw_enc_flush);
+**      -D      - primed dictionary file, its code bits and flags are used;
+**      -s      - dictionary size in KB, trains the primed dictionary
+**                on the input and writes it into the output file;
+**      -p      - read the input and write the raw stream by separate
+**                threads;
+**      -x      - write the block index, produces framed stream;
+**      -b      - block size in KB, produces framed stream;
+**      -t      - number of threads, produces framed stream;
 **      argv[1] - input file name;
 **      argv[2] - output file name;
 **
@@ -31,12 +432,106 @@ int main (int argc, char* argv[])
 {
 	FILE       *fin;
 	FILE       *fout;
-	lzw_enc_t  *ctx = &lzw;
+	lzw_enc_t  *ctx;
+	stream_t   out;
+	pipe_t     pipe;
+	pipe_t     in;
+	fmap_t     map;
+	int        mapped;
 	unsigned   len;
-	char       buf[256];
+	char       buf[0x10000];
+	unsigned   block_size = 0;
+	unsigned   nthreads   = 0;
+	unsigned   max_bits   = 0;
+	unsigned   bits_min   = DICT_BITS_MIN;
+	unsigned   bits_max   = ENC_BITS_MAX;
+	unsigned   flags      = 0;
+	int        zfile      = 0;
+	int        pipelined  = 0;
+	int        indexed    = 0;
+	unsigned   train      = 0;
+	char       *dict      = NULL;
+	unsigned   dict_size  = 0;
+	int        ret        = 0;
+
+	while (argc > 3 && argv[1][0] == '-')
+	{
+		if (argv[1][1] == 'c' || argv[1][1] == 'Z' || argv[1][1] == 'G' || argv[1][1] == 'T' || argv[1][1] == 'S' || argv[1][1] == 'p' || argv[1][1] == 'x') {
+			if (argv[1][1] == 'c')
+				flags |= LZW_FLAG_CLEAR;
+			else if (argv[1][1] == 'Z')
+				flags = LZW_DIALECT_Z, zfile = 1;
+			else if (argv[1][1] == 'G')
+				flags = LZW_DIALECT_GIF;
+			else if (argv[1][1] == 'T')
+				flags = LZW_DIALECT_TIFF;
+			else if (argv[1][1] == 'S')
+				flags |= LZW_FLAG_SYNC;
+			else if (argv[1][1] == 'p')
+				pipelined = 1;
+			else
+				indexed = 1;
+			argc--;
+			argv++;
+			continue;
+		}
+		else if (argv[1][1] == 'b')
+			block_size = atoi(argv[2]) * 1024;
+		else if (argv[1][1] == 't')
+			nthreads = atoi(argv[2]);
+		else if (argv[1][1] == 'm')
+			max_bits = atoi(argv[2]);
+		else if (argv[1][1] == 's')
+			train = atoi(argv[2]) * 1024;
+		else if (argv[1][1] == 'D')
+		{
+			FILE *f = fopen(argv[2], "rb");
+
+			if (!f || !(dict = read_all(f, &dict_size)) || dict_size < LZW_DICT_HDR_SIZE) {
+				fprintf(stderr, "Cannot read dictionary %s\n", argv[2]);
+				return -2;
+			}
+			fclose(f);
+
+			// the streams are encoded as the dictionary was trained
+			max_bits = (unsigned char)dict[8];
+			flags    = (unsigned char)dict[9];
+		}
+		else
+			break;
+
+		argc -= 2;
+		argv += 2;
+	}
 
 	if (argc < 3) {
-		printf("Usage: lzw-enc <input file> <output file>\n");
+		printf("Usage: lzw-enc [-m <max code bits>] [-c | -Z | -G | -T] [-S] [-D <dictionary>] [-p] [-x] [-b <block size KB>] [-t <threads>] <input file> <output file>\n");
+		printf("       lzw-enc [-m <max code bits>] [-c | -G | -T] -s <dictionary size KB> <sample file> <dictionary>\n");
+		return -1;
+	}
+
+	// the dialects limit the code size
+	if (zfile)
+		bits_min = LZW_Z_BITS_MIN, bits_max = LZW_Z_BITS;
+	else if (flags & LZW_FLAG_EOI)
+		bits_max = 12;
+
+	if (!max_bits)
+		max_bits = bits_max < DICT_BITS ? bits_max : DICT_BITS;
+
+	if (max_bits < bits_min || max_bits > bits_max) {
+		fprintf(stderr, "Max code bits should be %d..%d\n", bits_min, bits_max);
+		return -1;
+	}
+
+	// the stored block flag is the high bit of the block size
+	if (block_size >= LZW_BLOCK_STORED) {
+		fprintf(stderr, "Block size should be less than 2 GB\n");
+		return -1;
+	}
+
+	if (zfile && (block_size || nthreads || indexed || dict)) {
+		fprintf(stderr, "Unix compress file cannot be framed or primed\n");
 		return -1;
 	}
 
@@ -50,17 +545,113 @@ int main (int argc, char* argv[])
 		return -3;
 	}
 
-	lzw_enc_init(ctx, fout);
+	// the page faults of the mapped input would stall the encoder
+	mapped = !(pipelined && !block_size && !nthreads && !indexed && !train) && !fmap_open(&map, fin);
 
-	while (len = lzw_readbuf(fin, buf, sizeof(buf)))
+	if (train)
 	{
-		lzw_encode(ctx, buf, len);
+		char     *sample = mapped ? map.data : read_all(fin, &len);
+		char     *buf    = (char*)malloc(train);
+
+		if (mapped)
+			len = map.size < MAP_CHUNK ? (unsigned)map.size : MAP_CHUNK;
+
+		if (!buf || (ret = lzw_enc_train(buf, train, max_bits, flags, sample ? sample : "", sample ? len : 0)) < 0)
+			fprintf(stderr, "Error %d\n", buf ? ret : (ret = -4));
+		else {
+			fwrite(buf, ret, 1, fout);
+			ret = 0;
+		}
+
+		if (!mapped)
+			free(sample);
+		free(buf);
 	}
+	else if (block_size || nthreads || indexed)
+	{
+		if (!block_size)
+			block_size = LZW_BLOCK_SIZE;
+		if (!nthreads)
+			nthreads = cpu_count();
 
-	lzw_enc_end(ctx);
+		ret = encode_framed(fin, mapped ? &map : NULL, fout, block_size, max_bits, flags, dict, dict_size, indexed, nthreads);
+	}
+	else if (!(ctx = lzw_enc_create(max_bits)))
+	{
+		fprintf(stderr, "Out of memory\n");
+		ret = -4;
+	}
+	else if (lzw_enc_dict(ctx, dict, dict_size))
+	{
+		fprintf(stderr, "Wrong dictionary\n");
+		lzw_enc_destroy(ctx);
+		ret = LZW_ERR_DICT;
+	}
+	else
+	{
+		memset(&out, 0, sizeof(out));
+		out.file = fout;
+
+		if (zfile)
+		{
+			char hdr[LZW_Z_HDR_SIZE];
+
+			lzw_enc_z_hdr(hdr, max_bits);
+			fwrite(hdr, 1, sizeof(hdr), fout);
+		}
+
+		// the codes are written while the next input is encoded
+		if (pipelined && !pipe_open(&pipe, fout, 0))
+			out.pipe = &pipe;
+
+		// the dictionary sets the flags of its streams
+		if (!dict)
+			lzw_enc_flags(ctx, flags);
+		lzw_enc_sink(ctx, stream_write);
+		lzw_enc_init(ctx, &out);
+
+		if (mapped)
+		{
+			unsigned long long pos;
+
+			for (pos = 0; pos < map.size; pos += len)
+			{
+				len = map.size - pos < MAP_CHUNK ? (unsigned)(map.size - pos) : MAP_CHUNK;
+				lzw_encode(ctx, map.data + pos, len);
+			}
+		}
+		// the next input chunks are read while the current one is encoded
+		else if (pipelined && !pipe_open(&in, fin, 1))
+		{
+			char *chunk;
+
+			while (len = pipe_read(&in, &chunk))
+			{
+				lzw_encode(ctx, chunk, len);
+				lzw_enc_flush(ctx);
+			}
+
+			pipe_close(&in, 1);
+		}
+		else while (len = file_read(fin, buf, sizeof(buf)))
+		{
+			lzw_encode(ctx, buf, len);
+			lzw_enc_flush(ctx);
+		}
+
+		lzw_enc_end(ctx);
+		lzw_enc_destroy(ctx);
+
+		if (out.pipe)
+			pipe_close(out.pipe, 0);
+	}
+
+	if (mapped)
+		fmap_close(&map);
 
 	fclose(fin);
 	fclose(fout);
+	free(dict);
 
-	return 0;
-}
\ No newline at end of file
+	return ret;
+}
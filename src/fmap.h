@@ -0,0 +1,103 @@
+/******************************************************************************
+**  File mapping
+**  --------------------------------------------------------------------------
+**
+**  Minimal portable read-only file mapping for the encoder/decoder tools.
+**  Files which cannot be mapped (pipes, character devices) should be read
+**  by the buffered I/O.
+**
+**  Author: V.Antonenko
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 2 of the License,
+** or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+** See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along
+** with this program; if not, write to the Free Software Foundation, Inc.
+**
+******************************************************************************/
+#ifndef __FMAP_H__
+#define __FMAP_H__
+
+#include <stdio.h>
+
+// mapped file
+typedef struct _fmap
+{
+	char               *data;		// file content
+	unsigned long long size;		// file size
+#ifdef _WIN32
+	void               *handle;		// file mapping object
+#endif
+}
+fmap_t;
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <io.h>
+
+__inline static int fmap_open(fmap_t *m, FILE *f)
+{
+	HANDLE        file = (HANDLE)_get_osfhandle(_fileno(f));
+	LARGE_INTEGER size;
+
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || !size.QuadPart)
+		return -1;
+
+	if (!(m->handle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL)))
+		return -1;
+
+	if (!(m->data = (char*)MapViewOfFile(m->handle, FILE_MAP_READ, 0, 0, 0))) {
+		CloseHandle(m->handle);
+		return -1;
+	}
+
+	m->size = size.QuadPart;
+	return 0;
+}
+
+__inline static void fmap_close(fmap_t *m)
+{
+	UnmapViewOfFile(m->data);
+	CloseHandle(m->handle);
+}
+
+#else // POSIX
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+__inline static int fmap_open(fmap_t *m, FILE *f)
+{
+	struct stat st;
+	void        *p;
+
+	if (fstat(fileno(f), &st) || !S_ISREG(st.st_mode) || !st.st_size)
+		return -1;
+
+	if ((p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0)) == MAP_FAILED)
+		return -1;
+
+	// the file is read once from the beginning to the end
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+	m->data = (char*)p;
+	m->size = st.st_size;
+	return 0;
+}
+
+__inline static void fmap_close(fmap_t *m)
+{
+	munmap(m->data, m->size);
+}
+
+#endif // _WIN32
+
+#endif //__FMAP_H__
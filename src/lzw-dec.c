@@ -20,43 +20,415 @@
 ** with this program; if not, write to the Free Software Foundation, Inc.
 **
 ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
 #include "lzw.h"
 
 
+/******************************************************************************
+**  lzw_dec_load64
+**  --------------------------------------------------------------------------
+**  Loads 64-bit word from the code-buffer, the most significant byte first.
+**  
+**  Arguments:
+**      p - input position, may be unaligned;
+**
+**  Return: 64 bits
+******************************************************************************/
+__inline static unsigned long long lzw_dec_load64(const unsigned char *const p)
+{
+#ifdef LZW_BE64
+	unsigned long long w;
+
+	memcpy(&w, p, 8);
+	return LZW_BE64(w);
+#else
+	return ((unsigned long long)p[0] << 56) | ((unsigned long long)p[1] << 48) |
+	       ((unsigned long long)p[2] << 40) | ((unsigned long long)p[3] << 32) |
+	       ((unsigned long long)p[4] << 24) | ((unsigned long long)p[5] << 16) |
+	       ((unsigned long long)p[6] << 8)  |  (unsigned long long)p[7];
+#endif
+}
+
+/******************************************************************************
+**  lzw_dec_load64le
+**  --------------------------------------------------------------------------
+**  Loads 64-bit word from the code-buffer, the least significant byte
+**  first (LZW_FLAG_LSB).
+**  
+**  Arguments:
+**      p - input position, may be unaligned;
+**
+**  Return: 64-bit word
+******************************************************************************/
+__inline static unsigned long long lzw_dec_load64le(const unsigned char *const p)
+{
+#ifdef LZW_LE64
+	unsigned long long w;
+
+	memcpy(&w, p, 8);
+	return LZW_LE64(w);
+#else
+	return ((unsigned long long)p[7] << 56) | ((unsigned long long)p[6] << 48) |
+	       ((unsigned long long)p[5] << 40) | ((unsigned long long)p[4] << 32) |
+	       ((unsigned long long)p[3] << 24) | ((unsigned long long)p[2] << 16) |
+	       ((unsigned long long)p[1] << 8)  |  (unsigned long long)p[0];
+#endif
+}
+
 /******************************************************************************
 **  lzw_dec_readbits
 **  --------------------------------------------------------------------------
 **  Read bits from bit-buffer.
-**  The number of bits should not exceed 24.
+**  The number of bits should not exceed 32. While at least 8 bytes of
+**  input remain the 64-bit bit-buffer is refilled by one unaligned load,
+**  the tail of the input is read byte by byte. The flags are constant
+**  in the specialized loops.
 **  
 **  Arguments:
 **      ctx     - pointer to LZW context;
-**      nbits   - number of bits to read, 0-24;
+**      nbits   - number of bits to read, 0-32;
+**      flags   - stream flags;
 **
 **  Return: bits or -1 if there is no data
 ******************************************************************************/
-static int lzw_dec_readbits(lzw_dec_t *const ctx, unsigned nbits)
+__inline static int lzw_dec_readbits(lzw_dec_t *const ctx, unsigned nbits, const unsigned flags)
 {
-	// read bytes
-	while (ctx->bb.n < nbits)
+	if (flags & LZW_FLAG_LSB)
 	{
-		if (ctx->lzwn == ctx->lzwm)
-			return -1;
+		int bits;
+
+		if (ctx->bb.n < nbits)
+		{
+			if (ctx->lzwm - ctx->lzwn >= 8)
+			{
+				// add as many whole bytes as fit above the old bits
+				unsigned k = (63 - ctx->bb.n) >> 3;
+
+				ctx->bb.buf |= (lzw_dec_load64le(ctx->inbuff + ctx->lzwn) & ((1ULL << (k*8))-1)) << ctx->bb.n;
+				ctx->bb.n   += k*8;
+				ctx->lzwn   += k;
+			}
+			else
+			{
+				while (ctx->bb.n < nbits)
+				{
+					if (ctx->lzwn == ctx->lzwm)
+						return -1;
+
+					ctx->bb.buf |= (unsigned long long)ctx->inbuff[ctx->lzwn++] << ctx->bb.n;
+					ctx->bb.n   += 8;
+				}
+			}
+		}
+
+		bits = (int)(ctx->bb.buf & ((1ULL << nbits)-1));
+		ctx->bb.buf >>= nbits;
+		ctx->bb.n    -= nbits;
+
+		return bits;
+	}
+
+	if (ctx->bb.n < nbits)
+	{
+		if (ctx->lzwm - ctx->lzwn >= 8)
+		{
+			// add as many whole bytes as fit into the bit-buffer
+			unsigned k = (63 - ctx->bb.n) >> 3;
+
+			ctx->bb.buf = (ctx->bb.buf << (k*8)) | (lzw_dec_load64(ctx->inbuff + ctx->lzwn) >> (64 - k*8));
+			ctx->bb.n  += k*8;
+			ctx->lzwn  += k;
+		}
+		else
+		{
+			// read bytes
+			while (ctx->bb.n < nbits)
+			{
+				if (ctx->lzwn == ctx->lzwm)
+					return -1;
 
-		// shift old bits to the left, add new to the right
-		ctx->bb.buf = (ctx->bb.buf << 8) | ctx->inbuff[ctx->lzwn++];
-		ctx->bb.n += 8;
+				// shift old bits to the left, add new to the right
+				ctx->bb.buf = (ctx->bb.buf << 8) | ctx->inbuff[ctx->lzwn++];
+				ctx->bb.n += 8;
+			}
+		}
 	}
 
 	ctx->bb.n -= nbits;
 
-	return (ctx->bb.buf >> ctx->bb.n) & ((1 << nbits)-1);
+	return (int)((ctx->bb.buf >> ctx->bb.n) & ((1ULL << nbits)-1));
+}
+
+#if DEC_BATCH
+/******************************************************************************
+**  lzw_dec_span
+**  --------------------------------------------------------------------------
+**  Counts the codes which are read with the current code size. Every code
+**  adds at most one string to the dictionary, so the code size does not
+**  change before the dictionary grows to the next power of two (or it is
+**  reset by CLEAR code). The code size of the full dictionary kept until
+**  CLEAR code (LZW_FLAG_CLEAR) does not change at all.
+**  
+**  Arguments:
+**      ctx     - pointer to LZW context;
+**      flags   - stream flags;
+**
+**  Return: number of codes, up to DEC_BATCH.
+******************************************************************************/
+__inline static unsigned lzw_dec_span(const lzw_dec_t *const ctx, const unsigned flags)
+{
+	const int n = (int)(1u << ctx->codesize) - (flags & LZW_FLAG_EARLY ? 2 : 1) - (int)ctx->max;
+
+	if (ctx->codesize == ctx->maxbits && n <= 0)
+		return DEC_BATCH;
+
+	return n < DEC_BATCH ? (unsigned)n : DEC_BATCH;
+}
+
+/******************************************************************************
+**  lzw_dec_unpack
+**  --------------------------------------------------------------------------
+**  Reads up to n codes of the current code size. Every code is extracted
+**  by its own unaligned load from the code-buffer, so there is no
+**  bit-buffer dependency between the codes. Only the codes which are
+**  followed by at least 8 bytes of input are read, the rest is left
+**  to lzw_dec_readbits. Reading stops after CLEAR code (LZW_FLAG_CLEAR)
+**  because the next codes are 9-bit, after EOI code (LZW_FLAG_EOI) and
+**  after SYNC code (LZW_FLAG_SYNC) followed by the padding.
+**  
+**  Arguments:
+**      ctx     - pointer to LZW context;
+**      codes   - output codes;
+**      n       - maximal number of codes;
+**      flags   - stream flags;
+**
+**  Return: number of codes read, 0 if the bits are not in the code-buffer.
+******************************************************************************/
+__inline static unsigned lzw_dec_unpack(lzw_dec_t *const ctx, int codes[], unsigned n, const unsigned flags)
+{
+	const unsigned     nbits = ctx->codesize;
+	unsigned long long pos, last;
+	unsigned           i;
+
+	// the bit-buffer has the bits of the previous code-buffer
+	if (!n || ctx->bb.n > ctx->lzwn*8 || ctx->lzwm - ctx->lzwn < 16)
+		return 0;
+
+	// the group padding is skipped first (LZW_FLAG_GROUP)
+	if ((flags & LZW_FLAG_GROUP) && ctx->skip)
+		return 0;
+
+	// bit position of the first code and of the last loadable code
+	pos  = ctx->lzwn*8ULL - ctx->bb.n;
+	last = (ctx->lzwm - 8)*8ULL;
+
+	if (n > (last - pos) / nbits + 1)
+		n = (unsigned)((last - pos) / nbits + 1);
+
+	for (i = 0; i < n;)
+	{
+		if (flags & LZW_FLAG_LSB)
+			codes[i] = (int)((lzw_dec_load64le(ctx->inbuff + (pos >> 3)) >> (pos & 7)) & ((1u << nbits)-1));
+		else
+			codes[i] = (int)((lzw_dec_load64(ctx->inbuff + (pos >> 3)) >> (64 - nbits - (pos & 7))) & ((1u << nbits)-1));
+		pos += nbits;
+
+		if ((flags & LZW_FLAG_CLEAR) && codes[i] == LZW_CODE_CLEAR) {
+			i++;
+			break;
+		}
+		if ((flags & LZW_FLAG_EOI) && codes[i] == LZW_CODE_EOI) {
+			i++;
+			break;
+		}
+		if ((flags & LZW_FLAG_SYNC) && codes[i] == LZW_CODE_SYNC) {
+			i++;
+			break;
+		}
+		i++;
+	}
+
+	// the bit-buffer keeps the rest of the last byte
+	ctx->lzwn   = (unsigned)((pos + 7) >> 3);
+	ctx->bb.n   = (unsigned)(ctx->lzwn*8ULL - pos);
+	ctx->bb.buf = flags & LZW_FLAG_LSB ? ctx->inbuff[ctx->lzwn-1] >> (8 - ctx->bb.n) : ctx->inbuff[ctx->lzwn-1];
+
+	return i;
+}
+#endif
+
+/******************************************************************************
+**  lzw_dec_skip
+**  --------------------------------------------------------------------------
+**  Skips the padding of the code group (LZW_FLAG_GROUP) before the next
+**  code. The padding may be split between the code-buffers.
+**  
+**  Arguments:
+**      ctx     - pointer to LZW context;
+**      flags   - stream flags;
+**
+**  Return: 0 or -1 if there is no data
+******************************************************************************/
+static int lzw_dec_skip(lzw_dec_t *const ctx, const unsigned flags)
+{
+	while (ctx->skip)
+	{
+		unsigned n = ctx->skip < 24 ? ctx->skip : 24;
+
+		if (lzw_dec_readbits(ctx, n, flags) < 0)
+			return -1;
+
+		ctx->skip -= n;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_dec_getcode
+**  --------------------------------------------------------------------------
+**  Reads the next code from the code-buffer.
+**  
+**  Arguments:
+**      ctx     - pointer to LZW context;
+**      flags   - stream flags;
+**
+**  Return: code or -1 if there is no data
+******************************************************************************/
+__inline static int lzw_dec_getcode(lzw_dec_t *const ctx, const unsigned flags)
+{
+	if ((flags & LZW_FLAG_GROUP) && ctx->skip && lzw_dec_skip(ctx, flags) < 0)
+		return -1;
+
+	return lzw_dec_readbits(ctx, ctx->codesize, flags);
+}
+
+/******************************************************************************
+**  lzw_dec_sink
+**  --------------------------------------------------------------------------
+**  Sets the output callback of the context, it is called with the stream
+**  of lzw_dec_init and the decoded bytes. The callback is kept by
+**  lzw_dec_init, so the contexts of one application may write into
+**  different kinds of streams.
+**  
+**  Arguments:
+**      ctx   - LZW decoder context;
+**      write - output callback or NULL for lzw_writebuf (LZW_WRITEBUF);
+**
+**  Return: -
+******************************************************************************/
+void lzw_dec_sink(lzw_dec_t *ctx, lzw_write_t write)
+{
+#if LZW_WRITEBUF
+	ctx->write = write ? write : lzw_writebuf;
+#else
+	ctx->write = write;
+#endif
+}
+
+/******************************************************************************
+**  lzw_dec_create
+**  --------------------------------------------------------------------------
+**  Allocates LZW decoder context. The dictionary and the buffers are
+**  allocated together with the context and sized for the maximal code.
+**  
+**  Arguments:
+**      max_bits - number of bits in the maximal code,
+**                 DICT_BITS_MIN..DICT_BITS_MAX;
+**
+**  Return: LZW decoder context or NULL. It should be freed by lzw_dec_destroy.
+******************************************************************************/
+lzw_dec_t *lzw_dec_create(unsigned max_bits)
+{
+	lzw_dec_t *ctx;
+	unsigned  osize = DEC_OBUFF_SIZE;
+	unsigned  i;
+#if DEC_WINDOW
+	unsigned  wsize = DEC_WINDOW;
+#endif
+
+	if (max_bits < DICT_BITS_MIN || max_bits > DICT_BITS_MAX)
+		return NULL;
+
+#if DEC_WINDOW
+	// there is no use of the window which exceeds the dictionary strings
+	if (max_bits < 28 && (4u << max_bits) < wsize)
+		wsize = 4u << max_bits;
+
+	osize += 2 * wsize;
+#endif
+
+	ctx = (lzw_dec_t*)malloc(sizeof(lzw_dec_t) + ((sizeof(node_dec_t) + 1) << max_bits) + osize);
+
+	if (ctx)
+	{
+		ctx->maxbits = max_bits;
+		ctx->flags   = 0;
+		ctx->dst     = NULL;
+		ctx->pmax    = 0;
+		lzw_dec_sink(ctx, NULL);
+		ctx->osize   = osize;
+#if DEC_WINDOW
+		ctx->wsize   = wsize;
+#endif
+		ctx->dict    = (node_dec_t*)(ctx + 1);
+		ctx->obuff   = (unsigned char*)(ctx->dict + (1 << max_bits));
+		ctx->buff    = ctx->obuff + osize;
+
+		// the root strings are never overwritten, lzw_dec_init keeps them
+		for (i = 0; i < 256; i++)
+		{
+			ctx->dict[i].prev = CODE_NULL;
+			ctx->dict[i].ch   = i;
+#if DEC_WINDOW
+			ctx->dict[i].len  = 1;
+#endif
+		}
+	}
+
+	return ctx;
+}
+
+/******************************************************************************
+**  lzw_dec_destroy
+**  --------------------------------------------------------------------------
+**  Frees LZW decoder context allocated by lzw_dec_create.
+**  
+**  Arguments:
+**      ctx - LZW decoder context;
+**
+**  Return: -
+******************************************************************************/
+void lzw_dec_destroy(lzw_dec_t *ctx)
+{
+	free(ctx);
+}
+
+/******************************************************************************
+**  lzw_dec_flags
+**  --------------------------------------------------------------------------
+**  Sets the stream flags (LZW_FLAG_*) or the dialect (LZW_DIALECT_*),
+**  they should be the same as the encoder flags. The flags take effect
+**  at the next lzw_dec_init. The primed dictionary (lzw_dec_dict)
+**  is dropped.
+**  
+**  Arguments:
+**      ctx   - LZW decoder context;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+void lzw_dec_flags(lzw_dec_t *ctx, unsigned flags)
+{
+	ctx->flags = flags & ~LZW_FLAG_LSB ? flags | LZW_FLAG_CLEAR : flags;
+	ctx->pmax  = 0;
 }
 
 /******************************************************************************
 **  lzw_dec_init
 **  --------------------------------------------------------------------------
-**  Initializes LZW decoder context.
+**  Initializes LZW decoder context created by lzw_dec_create.
 **  
 **  Arguments:
 **      ctx     - LZW decoder context;
@@ -66,26 +438,42 @@ static int lzw_dec_readbits(lzw_dec_t *const ctx, unsigned nbits)
 ******************************************************************************/
 void lzw_dec_init(lzw_dec_t *ctx, void *stream)
 {
-	unsigned i;
-
 	ctx->code     = CODE_NULL;
-	ctx->max      = 255;
-	ctx->codesize = 8;
+	// codes 256..258 are reserved for CLEAR, EOI and SYNC codes
+	ctx->max      = LZW_CODE_LAST(ctx->flags);
+	ctx->codesize = ctx->flags & LZW_FLAG_CLEAR ? 9 : 8;
+	// the primed strings follow (lzw_dec_dict)
+	if (ctx->pmax) {
+		ctx->max      = ctx->pmax;
+		ctx->codesize = ctx->psize;
+	}
 	ctx->bb.n     = 0; // bitbuffer init
+	ctx->bb.buf   = 0;
+	ctx->gbits    = 0;
+	ctx->skip     = 0;
+	ctx->end      = 0;
 	ctx->stream   = stream;
-
-	for (i = 0; i < 256; i++)
-	{
-		ctx->dict[i].prev = CODE_NULL;
-		ctx->dict[i].ch   = i;
-	}
+	ctx->outn     = 0; // output buffer init
+	ctx->outf     = 0;
+	ctx->io       = NULL;
+	ctx->plen     = 0;
+#if LZW_STATS
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+#endif
+#if DEC_WINDOW
+	ctx->wpos     = 0;
+	ctx->gpos     = 0;
+	ctx->ppos     = 0;
+#endif
 }
 
 /******************************************************************************
 **  lzw_dec_reset
 **  --------------------------------------------------------------------------
-**  Reset LZW decoder context. Used when the dictionary overflows.
-**  Code size set to 8 bit. Code and output str are equal in this situation.
+**  Reset LZW decoder context. Used when the dictionary overflows
+**  or on CLEAR code. Code size set to 8 bit (9 bit with CLEAR code).
+**  The primed strings are never overwritten, they are kept.
+**  Code and output str are equal in this situation.
 **  
 **  Arguments:
 **      ctx     - LZW decoder context;
@@ -95,11 +483,19 @@ void lzw_dec_init(lzw_dec_t *ctx, void *stream)
 static void lzw_dec_reset(lzw_dec_t *const ctx)
 {
 	ctx->code     = CODE_NULL;
-	ctx->max      = 255;
-	ctx->codesize = 8;
+	ctx->max      = LZW_CODE_LAST(ctx->flags);
+	ctx->codesize = ctx->flags & LZW_FLAG_CLEAR ? 9 : 8;
+	if (ctx->pmax) {
+		ctx->max      = ctx->pmax;
+		ctx->codesize = ctx->psize;
+	}
+#if DEC_WINDOW
+	ctx->gpos     = ctx->wpos + ctx->outn;
+#endif
 #if DEBUG
 	printf("reset\n");
 #endif
+	LZW_STAT(ctx->stats.resets++);
 }
 
 
@@ -118,7 +514,7 @@ static void lzw_dec_reset(lzw_dec_t *const ctx)
 ******************************************************************************/
 static unsigned lzw_dec_getstr(lzw_dec_t *const ctx, int code)
 {
-	unsigned i = sizeof(ctx->buff);
+	unsigned i = 1u << ctx->maxbits;
 
 	while (code != CODE_NULL && i)
 	{
@@ -126,7 +522,10 @@ static unsigned lzw_dec_getstr(lzw_dec_t *const ctx, int code)
 		code = ctx->dict[code].prev;
 	}
 
-	return sizeof(ctx->buff) - i;
+	LZW_STAT(ctx->stats.walks++);
+	LZW_STAT(ctx->stats.walk_bytes += (1u << ctx->maxbits) - i);
+
+	return (1u << ctx->maxbits) - i;
 }
 
 /******************************************************************************
@@ -146,11 +545,18 @@ static int lzw_dec_addstr(lzw_dec_t *const ctx, int code, unsigned char c)
 	if (code == CODE_NULL)
 		return c;
 		
-	if (++ctx->max == CODE_NULL)
+	if (ctx->max+1 == (1u << ctx->maxbits))
 		return CODE_NULL;
 
+	++ctx->max;
+
 	ctx->dict[ctx->max].prev = code;
 	ctx->dict[ctx->max].ch   = c;
+#if DEC_WINDOW
+	// the string is <code> string followed by its next symbol in the output
+	ctx->dict[ctx->max].len  = ctx->dict[code].len + 1;
+	ctx->dict[ctx->max].pos  = ctx->ppos;
+#endif
 #if DEBUG
 	printf("add code %x = %x + %c\n", ctx->max, code, c);
 #endif
@@ -159,105 +565,1122 @@ static int lzw_dec_addstr(lzw_dec_t *const ctx, int code, unsigned char c)
 }
 
 /******************************************************************************
-**  lzw_dec_writestr
+**  lzw_dec_write
 **  --------------------------------------------------------------------------
-**  Writes a string represented by the code into output stream.
-**  The code should always be in the dictionary.
-**  It is important that codesize is increased after code is sent into
-**  output stream.
+**  Writes decoded bytes into the output stream, into the output buffer
+**  of lzw_decompress or to the output cursor of lzw_dec_stream.
+**  The bytes which do not fit into the lzw_decompress buffer are
+**  counted but not written.
+**  
+**  Arguments:
+**      ctx  - LZW decoder context;
+**      buf  - bytes to write;
+**      size - number of bytes;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_dec_write(lzw_dec_t *const ctx, const unsigned char *buf, unsigned size)
+{
+	if (ctx->io)
+	{
+		lzw_io_t *io = ctx->io;
+		unsigned n   = size < io->avail_out ? size : io->avail_out;
+
+		memcpy(io->next_out, buf, n);
+		io->next_out  += n;
+		io->avail_out -= n;
+
+		// only a long string may not fit, it stays in the string buffer
+		if (n < size) {
+			ctx->pstr = (unsigned char*)buf + n;
+			ctx->plen = size - n;
+		}
+		return;
+	}
+
+	if (!ctx->dst) {
+		ctx->write(ctx->stream, (char*)buf, size);
+		return;
+	}
+
+	if (ctx->dsize + size <= ctx->dcap)
+		memcpy(ctx->dst + ctx->dsize, buf, size);
+
+	ctx->dsize += size;
+}
+
+/******************************************************************************
+**  lzw_dec_flush
+**  --------------------------------------------------------------------------
+**  Writes the content of the output buffer into the output stream.
 **  
 **  Arguments:
 **      ctx  - LZW context;
-**      code - LZW code;
 **
-**  Return: The first symbol of the output string.
+**  Return: -
 ******************************************************************************/
-static unsigned char lzw_dec_writestr(lzw_dec_t *const ctx, int code)
+static void lzw_dec_flush(lzw_dec_t *const ctx)
 {
-	// get string for the new code from dictionary
-	unsigned strlen = lzw_dec_getstr(ctx, code);
+#if DEC_WINDOW
+	if (ctx->outn != ctx->outf) {
+		lzw_dec_write(ctx, ctx->obuff + ctx->outf, ctx->outn - ctx->outf);
+		ctx->outf = ctx->outn;
+	}
+#else
+	if (ctx->outn != ctx->outf)
+		lzw_dec_write(ctx, ctx->obuff + ctx->outf, ctx->outn - ctx->outf);
 
-	// write the string into the output stream
-	lzw_writebuf(ctx->stream, ctx->buff+(sizeof(ctx->buff) - strlen), strlen);
+	ctx->outn = ctx->outf = 0;
+#endif
+}
 
-	// to remember the first sybmol of this string
-	return ctx->buff[sizeof(ctx->buff) - strlen];
+#if DEC_WINDOW
+/******************************************************************************
+**  lzw_dec_slide
+**  --------------------------------------------------------------------------
+**  Flushes the output buffer and moves the last window bytes of
+**  the output to the beginning of the buffer.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_dec_slide(lzw_dec_t *const ctx)
+{
+	unsigned keep = ctx->outn < ctx->wsize ? ctx->outn : ctx->wsize;
+
+	lzw_dec_flush(ctx);
+
+	memmove(ctx->obuff, ctx->obuff + ctx->outn - keep, keep);
+	ctx->wpos += ctx->outn - keep;
+	ctx->outn  = ctx->outf = keep;
 }
 
 /******************************************************************************
-**  lzw_decode
+**  lzw_dec_writestr
 **  --------------------------------------------------------------------------
-**  Decodes buffer of LZW codes and writes strings into output stream.
-**  The output data is written by application specific callback to
-**  the application defined stream inside this function.
+**  Writes a string represented by the code into output stream.
+**  The code should always be in the dictionary.
+**  The string is copied from its previous occurrence in the output window,
+**  the dictionary is walked only if the string has left the window.
 **  
 **  Arguments:
 **      ctx  - LZW context;
-**      buf  - input code buffer;
-**      size - size of the buffer;
+**      code - LZW code;
 **
-**  Return: Number of processed bytes or error code if the value is negative.
+**  Return: The first symbol of the output string.
 ******************************************************************************/
-int lzw_decode(lzw_dec_t *ctx, char buf[], unsigned size)
+static unsigned char lzw_dec_writestr(lzw_dec_t *const ctx, int code)
 {
-	if (!size) return 0;
+	const unsigned     len = ctx->dict[code].len;
+	unsigned long long pos;
+	unsigned char      *dst;
 
-	ctx->inbuff = buf;	// save ptr to code-buffer
-	ctx->lzwn   = 0;	// current position in code-buffer
-	ctx->lzwm   = size;	// code-buffer data size
+	LZW_STAT(ctx->stats.strings++);
+	LZW_STAT(ctx->stats.out += len);
 
-	for (;;)
+	// the string does not fit into the output buffer
+	if (ctx->outn + len > ctx->osize)
+		lzw_dec_slide(ctx);
+
+	pos = ctx->wpos + ctx->outn;
+
+	// string positions are counted from the dictionary reset,
+	// ~0 marks a position which does not fit into 32 bits
+	ctx->npos = pos - ctx->gpos < ~0u ? (unsigned)(pos - ctx->gpos) : ~0u;
+
+	// too long string is written directly into the output stream
+	if (len > ctx->osize - ctx->outn)
 	{
-		int ncode;
+		unsigned char *str = ctx->buff + ((1u << ctx->maxbits) - lzw_dec_getstr(ctx, code));
 
-		// read a code from the input buffer (ctx->inbuff[])
-		ncode = lzw_dec_readbits(ctx, ctx->codesize);
-#if DEBUG
-		printf("code %x (%d)\n", ncode, ctx->codesize);
-#endif
+		lzw_dec_write(ctx, str, len);
 
-		// check the input for EOF
-		if (ncode < 0)
-		{
-#if DEBUG
-			if (ctx->lzwn != ctx->lzwm)
-				return LZW_ERR_INPUT_BUF;
-#endif
-			break;
-		}
-		else if (ncode <= ctx->max) // known code
-		{
-			// output string for the new code from dictionary
-			ctx->c = lzw_dec_writestr(ctx, ncode);
+		// the window is empty now
+		ctx->wpos = pos + len;
+		ctx->outn = ctx->outf = 0;
 
-			// add <prev code str>+<first str symbol> to the dictionary
-			if (lzw_dec_addstr(ctx, ctx->code, ctx->c) == CODE_NULL)
-				return LZW_ERR_DICT_IS_FULL;
-		}
-		else // unknown code
-		{
-			// try to guess the code
-			if (ncode != ctx->max+1)
-				return LZW_ERR_WRONG_CODE;
+		return str[0];
+	}
 
-			// create code: <nc> = <code> + <c> wich is equal to ncode
-			if (lzw_dec_addstr(ctx, ctx->code, ctx->c) == CODE_NULL)
-				return LZW_ERR_DICT_IS_FULL;
+	dst = ctx->obuff + ctx->outn;
 
-			// output string for the new code from dictionary
-			ctx->c = lzw_dec_writestr(ctx, ncode);
-		}
+	if (len == 1)
+	{
+		*dst = ctx->dict[code].ch;
+	}
+	else if (ctx->dict[code].pos != ~0u && ctx->gpos + ctx->dict[code].pos >= ctx->wpos)
+	{
+		const unsigned char *src = ctx->obuff + (unsigned)(ctx->gpos + ctx->dict[code].pos - ctx->wpos);
 
-		ctx->code = ncode;
+		// <code>+<c> where the string of <code> was just written (KwKwK):
+		// the last symbol is the first symbol of the string itself
+		if (src + len > dst) {
+			memcpy(dst, src, len - 1);
+			dst[len-1] = src[0];
+		}
+		else
+			memcpy(dst, src, len);
+	}
+	else
+	{
+		// the string is out of the window - walk the dictionary
+		unsigned char *p = dst + len;
 
-		// increase the code size (number of bits) if needed
-		if (ctx->max+1 == (1 << ctx->codesize))
-			ctx->codesize++;
+		LZW_STAT(ctx->stats.walks++);
+		LZW_STAT(ctx->stats.walk_bytes += len);
 
-		// check the dictionary overflow
-		if (ctx->max+1 == DICT_SIZE)
-			lzw_dec_reset(ctx);
+		while (code != CODE_NULL)
+		{
+			*--p = ctx->dict[code].ch;
+			code = ctx->dict[code].prev;
+		}
 	}
 
-	return ctx->lzwn;
+	ctx->outn += len;
+
+	// to remember the first sybmol of this string
+	return dst[0];
+}
+#else
+/******************************************************************************
+**  lzw_dec_writestr
+**  --------------------------------------------------------------------------
+**  Writes a string represented by the code into output stream.
+**  The code should always be in the dictionary.
+**  It is important that codesize is increased after code is sent into
+**  output stream.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - LZW code;
+**
+**  Return: The first symbol of the output string.
+******************************************************************************/
+static unsigned char lzw_dec_writestr(lzw_dec_t *const ctx, int code)
+{
+	// get string for the new code from dictionary
+	unsigned      strlen = lzw_dec_getstr(ctx, code);
+	unsigned char *str   = ctx->buff + ((1u << ctx->maxbits) - strlen);
+
+	LZW_STAT(ctx->stats.strings++);
+	LZW_STAT(ctx->stats.out += strlen);
+
+	// the string does not fit into the output buffer
+	if (ctx->outn + strlen > ctx->osize)
+	{
+		lzw_dec_flush(ctx);
+
+		// too long string is written directly into the output stream
+		if (strlen > ctx->osize) {
+			lzw_dec_write(ctx, str, strlen);
+			return str[0];
+		}
+	}
+
+	// write the string into the output buffer
+	memcpy(ctx->obuff + ctx->outn, str, strlen);
+	ctx->outn += strlen;
+
+	// to remember the first sybmol of this string
+	return str[0];
+}
+#endif
+
+#if DEC_BATCH && DEC_PREFETCH && DEC_WINDOW
+/******************************************************************************
+**  lzw_dec_prefetch
+**  --------------------------------------------------------------------------
+**  Prefetches the window copy of the code string which will be written
+**  soon. The node of the code is prefetched earlier. The codes which
+**  are not in the dictionary yet are skipped, their nodes are not set,
+**  as well as the single-symbol strings and the reserved codes which
+**  have no window copy.
+**  
+**  Arguments:
+**      ctx   - LZW context;
+**      code  - LZW code;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_dec_prefetch(const lzw_dec_t *const ctx, int code, const unsigned flags)
+{
+	const node_dec_t *node = &ctx->dict[code];
+
+	if (code > (int)ctx->max || code <= LZW_CODE_LAST(flags))
+		return;
+
+	if (node->pos != ~0u && ctx->gpos + node->pos >= ctx->wpos && ctx->gpos + node->pos - ctx->wpos < ctx->osize)
+		LZW_PREFETCH(ctx->obuff + (unsigned)(ctx->gpos + node->pos - ctx->wpos));
+}
+#endif
+
+/******************************************************************************
+**  lzw_dec_align
+**  --------------------------------------------------------------------------
+**  The code size changes: the rest of the group of 8 codes
+**  (LZW_FLAG_GROUP) is skipped before the next code.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_dec_align(lzw_dec_t *const ctx)
+{
+	const unsigned group = ctx->codesize * 8;
+
+	ctx->skip  = (group - ctx->gbits % group) % group;
+	ctx->gbits = 0;
+}
+
+/******************************************************************************
+**  lzw_dec_unread
+**  --------------------------------------------------------------------------
+**  Returns the whole bytes of the bit-buffer to the input of the current
+**  call, the bytes loaded by the previous calls are already reported
+**  as consumed and are kept.
+**  
+**  Arguments:
+**      ctx   - LZW context;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_dec_unread(lzw_dec_t *const ctx, const unsigned flags)
+{
+	const unsigned k = (ctx->bb.n >> 3) < ctx->lzwn ? ctx->bb.n >> 3 : ctx->lzwn;
+
+	ctx->lzwn -= k;
+	ctx->bb.n -= k*8;
+
+	// the last loaded bytes are the high bits (LSB first) or the low bits
+	if (flags & LZW_FLAG_LSB)
+		ctx->bb.buf &= (1ULL << ctx->bb.n) - 1;
+	else
+		ctx->bb.buf >>= k*8;
+}
+
+/******************************************************************************
+**  lzw_dec_code
+**  --------------------------------------------------------------------------
+**  Decodes one code: writes its string into the output buffer and
+**  updates the dictionary.
+**  
+**  Arguments:
+**      ctx   - LZW context;
+**      ncode - code read from the input;
+**      flags - stream flags;
+**
+**  Return: 0, LZW_STREAM_END after EOI code or error code if the value
+**          is negative.
+******************************************************************************/
+__inline static int lzw_dec_code(lzw_dec_t *const ctx, int ncode, const unsigned flags)
+{
+	LZW_STAT(ctx->stats.codes[ctx->codesize]++);
+
+	if (flags & LZW_FLAG_GROUP)
+		ctx->gbits += ctx->codesize;
+
+	if (ncode == LZW_CODE_CLEAR && (flags & LZW_FLAG_CLEAR))
+	{
+		LZW_STAT(ctx->stats.clears++);
+		if (flags & LZW_FLAG_GROUP)
+			lzw_dec_align(ctx);
+		lzw_dec_reset(ctx);
+		return 0;
+	}
+	else if (ncode == LZW_CODE_EOI && (flags & LZW_FLAG_EOI))
+	{
+		// the whole bytes after EOI code are not consumed
+		lzw_dec_unread(ctx, flags);
+		ctx->bb.n &= 7;
+		ctx->end   = 1;
+		return LZW_STREAM_END;
+	}
+	else if (ncode == LZW_CODE_SYNC && (flags & LZW_FLAG_SYNC))
+	{
+		// the next code starts a new string, the padding to the byte
+		// (to the group with LZW_FLAG_GROUP) is skipped
+		ctx->code = CODE_NULL;
+
+		if (flags & LZW_FLAG_GROUP)
+			lzw_dec_align(ctx);
+		else
+		{
+			const unsigned pad = ctx->bb.n & 7;
+
+			if (flags & LZW_FLAG_LSB)
+				ctx->bb.buf >>= pad;
+			ctx->bb.n -= pad;
+		}
+		return 0;
+	}
+	else if (ncode <= ctx->max) // known code
+	{
+		// output string for the new code from dictionary
+		ctx->c = lzw_dec_writestr(ctx, ncode);
+
+		// add <prev code str>+<first str symbol> to the dictionary,
+		// the full dictionary is kept until CLEAR code (LZW_FLAG_CLEAR)
+		if (lzw_dec_addstr(ctx, ctx->code, ctx->c) == CODE_NULL && !(flags & LZW_FLAG_CLEAR))
+			return LZW_ERR_DICT_IS_FULL;
+	}
+	else // unknown code
+	{
+		// try to guess the code
+		if (ncode != ctx->max+1)
+			return LZW_ERR_WRONG_CODE;
+
+		LZW_STAT(ctx->stats.kwkwk++);
+
+		// create code: <nc> = <code> + <c> wich is equal to ncode
+		if (lzw_dec_addstr(ctx, ctx->code, ctx->c) == CODE_NULL)
+			return LZW_ERR_DICT_IS_FULL;
+
+		// output string for the new code from dictionary
+		ctx->c = lzw_dec_writestr(ctx, ncode);
+	}
+
+	ctx->code = ncode;
+#if DEC_WINDOW
+	ctx->ppos = ctx->npos;
+#endif
+
+	// increase the code size (number of bits) if needed,
+	// one code earlier with the early change (LZW_FLAG_EARLY)
+	if (ctx->max + (flags & LZW_FLAG_EARLY ? 2 : 1) == (1u << ctx->codesize) && ctx->codesize < ctx->maxbits)
+	{
+		if (flags & LZW_FLAG_GROUP)
+			lzw_dec_align(ctx);
+		ctx->codesize++;
+	}
+
+	// check the dictionary overflow
+	if (ctx->max+1 == (1u << ctx->maxbits) && !(flags & LZW_FLAG_CLEAR))
+		lzw_dec_reset(ctx);
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_dec_loop
+**  --------------------------------------------------------------------------
+**  Decodes the code-buffer. The function is inlined into lzw_decode
+**  with constant flags of the dialects, so the flag checks are removed
+**  from the specialized loops.
+**  
+**  Arguments:
+**      ctx   - LZW context;
+**      flags - stream flags;
+**
+**  Return: Number of processed bytes or error code if the value is negative.
+******************************************************************************/
+__inline static int lzw_dec_loop(lzw_dec_t *const ctx, const unsigned flags)
+{
+	int ret;
+
+	for (;;)
+	{
+#if DEC_BATCH
+		int      codes[DEC_BATCH];
+#else
+		int      codes[1];
+#endif
+		unsigned i, n = 0;
+
+#if DEC_BATCH
+		// read the codes of the same size at once
+		n = lzw_dec_unpack(ctx, codes, lzw_dec_span(ctx, flags), flags);
+#endif
+		if (!n)
+		{
+			// read a code from the input buffer (ctx->inbuff[])
+			codes[0] = lzw_dec_getcode(ctx, flags);
+			n = 1;
+		}
+
+		for (i = 0; i < n; i++)
+		{
+			const int ncode = codes[i];
+
+#if DEC_BATCH && DEC_PREFETCH
+			// the nodes and the strings of the next codes are fetched
+			// while the current string is written
+			if (i + DEC_PREFETCH < n)
+				LZW_PREFETCH(&ctx->dict[codes[i + DEC_PREFETCH]]);
+#if DEC_WINDOW
+			if (i + DEC_PREFETCH/2 < n)
+				lzw_dec_prefetch(ctx, codes[i + DEC_PREFETCH/2], flags);
+#endif
+#endif
+#if DEBUG
+			printf("code %x (%d)\n", ncode, ctx->codesize);
+#endif
+
+			// check the input for EOF
+			if (ncode < 0)
+			{
+#if DEBUG
+				if (ctx->lzwn != ctx->lzwm) {
+					ret = LZW_ERR_INPUT_BUF;
+					break;
+				}
+#endif
+				ret = ctx->lzwn;
+				break;
+			}
+
+			if ((ret = lzw_dec_code(ctx, ncode, flags)) < 0)
+				break;
+
+			// the bytes after EOI code are not decoded
+			if (ret == LZW_STREAM_END) {
+				ret = ctx->lzwn;
+				break;
+			}
+		}
+
+		if (i < n)
+			break;
+	}
+
+	return ret;
+}
+
+/******************************************************************************
+**  lzw_decode
+**  --------------------------------------------------------------------------
+**  Decodes buffer of LZW codes and writes strings into output stream.
+**  The output data is written by application specific callback to
+**  the application defined stream inside this function. The output
+**  buffer is always flushed before return. After EOI code (LZW_FLAG_EOI)
+**  the rest of the buffer is not processed and the next calls return 0.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      buf  - input code buffer;
+**      size - size of the buffer;
+**
+**  Return: Number of processed bytes or error code if the value is negative.
+******************************************************************************/
+int lzw_decode(lzw_dec_t *ctx, char buf[], unsigned size)
+{
+	int ret;
+
+	if (!size || ctx->end) return 0;
+
+	ctx->inbuff = buf;	// save ptr to code-buffer
+	ctx->lzwn   = 0;	// current position in code-buffer
+	ctx->lzwm   = size;	// code-buffer data size
+
+	switch (ctx->flags)
+	{
+	case 0:                ret = lzw_dec_loop(ctx, 0); break;
+	case LZW_FLAG_CLEAR:   ret = lzw_dec_loop(ctx, LZW_FLAG_CLEAR); break;
+	case LZW_DIALECT_Z:    ret = lzw_dec_loop(ctx, LZW_DIALECT_Z); break;
+	case LZW_DIALECT_GIF:  ret = lzw_dec_loop(ctx, LZW_DIALECT_GIF); break;
+	case LZW_DIALECT_TIFF: ret = lzw_dec_loop(ctx, LZW_DIALECT_TIFF); break;
+	default:               ret = lzw_dec_loop(ctx, ctx->flags); break;
+	}
+
+	lzw_dec_flush(ctx);
+	LZW_STAT(ctx->stats.in += ctx->lzwn);
+
+	return ret;
+}
+
+/******************************************************************************
+**  lzw_dec_drain
+**  --------------------------------------------------------------------------
+**  Copies the decoded bytes which are not written yet to the output
+**  cursor of lzw_dec_stream.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      io   - input/output cursors;
+**
+**  Return: 0 if all the bytes are copied, 1 if the output is full.
+******************************************************************************/
+static int lzw_dec_drain(lzw_dec_t *const ctx, lzw_io_t *io)
+{
+	unsigned n;
+
+	// the rest of the long string
+	if (ctx->plen)
+	{
+		n = ctx->plen < io->avail_out ? ctx->plen : io->avail_out;
+
+		memcpy(io->next_out, ctx->pstr, n);
+		io->next_out  += n;
+		io->avail_out -= n;
+		ctx->pstr     += n;
+
+		if (ctx->plen -= n)
+			return 1;
+	}
+
+	n = ctx->outn - ctx->outf < io->avail_out ? ctx->outn - ctx->outf : io->avail_out;
+
+	memcpy(io->next_out, ctx->obuff + ctx->outf, n);
+	io->next_out  += n;
+	io->avail_out -= n;
+	ctx->outf     += n;
+
+	if (ctx->outf != ctx->outn)
+		return 1;
+#if !DEC_WINDOW
+	ctx->outn = ctx->outf = 0;
+#endif
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_dec_stream
+**  --------------------------------------------------------------------------
+**  Decodes LZW codes from the input cursor into the output cursor.
+**  Decoding stops when the input is used up or the output is full,
+**  the rest of the output is kept in the context and the next call
+**  resumes from the same place, even in the middle of a string.
+**  The output stream callback is not used. The cursors are advanced,
+**  call it again with more output space if avail_out is 0.
+**  The input after EOI code (LZW_FLAG_EOI) is not consumed.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      io   - input/output cursors;
+**
+**  Return: 0, LZW_STREAM_END if EOI code is decoded and all the output
+**          is copied or error code if the value is negative.
+******************************************************************************/
+int lzw_dec_stream(lzw_dec_t *ctx, lzw_io_t *io)
+{
+	int ret   = 0;
+	int ncode = 0;
+
+	ctx->inbuff = (unsigned char*)io->next_in;
+	ctx->lzwn   = 0;
+	ctx->lzwm   = io->avail_in;
+
+	if (!lzw_dec_drain(ctx, io) && !ctx->end)
+	{
+		ctx->io = io;
+
+		// the output which fits into the cursor is copied by lzw_dec_flush
+		while (ctx->outn - ctx->outf < io->avail_out)
+		{
+			ncode = lzw_dec_getcode(ctx, ctx->flags);
+
+			if (ncode < 0 || (ret = lzw_dec_code(ctx, ncode, ctx->flags)) != 0)
+				break;
+		}
+
+		// the bytes read ahead stay in the input when the output is full,
+		// so the bytes after EOI code are always loaded by the same call
+		if (ncode >= 0 && !ctx->end)
+			lzw_dec_unread(ctx, ctx->flags);
+
+		ctx->io = NULL;
+		lzw_dec_drain(ctx, io);
+	}
+
+	if (ctx->end && ret >= 0)
+		ret = ctx->plen || ctx->outf != ctx->outn ? 0 : LZW_STREAM_END;
+
+	io->next_in  += ctx->lzwn;
+	io->avail_in -= ctx->lzwn;
+	LZW_STAT(ctx->stats.in += ctx->lzwn);
+
+	return ret;
+}
+
+/******************************************************************************
+**  lzw_dec_stats
+**  --------------------------------------------------------------------------
+**  Copies the decoder statistics collected since lzw_dec_init.
+**  The statistics are collected only if the codec is built with LZW_STATS.
+**  The average length of the strings built by walking the dictionary
+**  is walk_bytes / walks.
+**  
+**  Arguments:
+**      ctx   - LZW decoder context;
+**      stats - output statistics;
+**
+**  Return: 0 or -1 if the statistics are not collected (stats are zeroed).
+******************************************************************************/
+int lzw_dec_stats(const lzw_dec_t *ctx, lzw_dec_stats_t *stats)
+{
+#if LZW_STATS
+	*stats = ctx->stats;
+	return 0;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return -1;
+#endif
+}
+
+/******************************************************************************
+**  lzw_dec_bits
+**  --------------------------------------------------------------------------
+**  Selects the smallest dictionary which never overflows for the output
+**  of the given size, up to DICT_BITS (see lzw_enc_bits).
+**  
+**  Arguments:
+**      size - output size;
+**
+**  Return: number of bits in the maximal code
+******************************************************************************/
+static unsigned lzw_dec_bits(unsigned size)
+{
+	unsigned bits = DICT_BITS_MIN;
+
+	// every code except the first one adds a string to the dictionary
+	while (bits < DICT_BITS && (1u << bits) - 256 <= size)
+		bits++;
+
+	return bits;
+}
+
+/******************************************************************************
+**  lzw_decompress
+**  --------------------------------------------------------------------------
+**  Decodes the raw code stream produced by lzw_compress into the output
+**  buffer in one call. The stream callbacks are not used.
+**  
+**  Arguments:
+**      dst     - output buffer;
+**      dst_cap - output buffer size;
+**      src     - input code buffer;
+**      size    - size of the input;
+**
+**  Return: Number of output bytes or error code if the value is negative.
+******************************************************************************/
+int lzw_decompress(char *dst, unsigned dst_cap, const char *src, unsigned size)
+{
+	lzw_dec_t *ctx = lzw_dec_create(lzw_dec_bits(dst_cap));
+	int       ret;
+
+	if (!ctx)
+		return LZW_ERR_MEMORY;
+
+	lzw_dec_init(ctx, NULL);
+	ctx->dst   = (unsigned char*)dst;
+	ctx->dsize = 0;
+	ctx->dcap  = dst_cap;
+
+	if ((ret = lzw_decode(ctx, (char*)src, size)) >= 0)
+		ret = ctx->dsize > ctx->dcap || ctx->dsize > 0x7FFFFFFF ? LZW_ERR_OUTPUT_BUF : (int)ctx->dsize;
+
+	lzw_dec_destroy(ctx);
+
+	return ret;
+}
+
+/******************************************************************************
+**  lzw_dec_get32
+**  --------------------------------------------------------------------------
+**  Loads 32-bit value stored in little-endian byte order.
+**  
+**  Arguments:
+**      p - input bytes;
+**
+**  Return: value
+******************************************************************************/
+static unsigned lzw_dec_get32(const char *const p)
+{
+	const unsigned char *b = (const unsigned char *)p;
+
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((unsigned)b[3] << 24);
+}
+
+/******************************************************************************
+**  lzw_dec_frame_hdr
+**  --------------------------------------------------------------------------
+**  Parses the header of the framed stream. If the blocks use the primed
+**  dictionary (LZW_FRAME_DICT option in hdr[7]) its ID follows the header,
+**  see lzw_dec_frame_dict.
+**  
+**  Arguments:
+**      hdr        - header bytes;
+**      block_size - output: maximal uncompressed block size;
+**      max_bits   - output: number of bits in the maximal code;
+**      flags      - output: stream flags of the blocks;
+**
+**  Return: 0 or LZW_ERR_FRAME if it is not a supported framed stream.
+******************************************************************************/
+int lzw_dec_frame_hdr(const char hdr[LZW_FRAME_HDR_SIZE], unsigned *block_size, unsigned *max_bits, unsigned *flags)
+{
+	unsigned i;
+
+	for (i = 0; i < 4; i++)
+		if (hdr[i] != LZW_FRAME_MAGIC[i])
+			return LZW_ERR_FRAME;
+
+	if (hdr[4] != LZW_FRAME_VERSION || hdr[5] < DICT_BITS_MIN || hdr[5] > DICT_BITS_MAX)
+		return LZW_ERR_FRAME;
+
+	if (((unsigned char)hdr[6] & ~LZW_FLAGS) || ((unsigned char)hdr[7] & ~(LZW_FRAME_DICT | LZW_FRAME_INDEX | LZW_FRAME_STORED)))
+		return LZW_ERR_FRAME;
+
+	*block_size = lzw_dec_get32(hdr+8);
+	*max_bits   = hdr[5];
+	*flags      = (unsigned char)hdr[6];
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_dec_block_hdr
+**  --------------------------------------------------------------------------
+**  Parses the header of a block in the framed stream. Every block should
+**  be decoded by a freshly initialized decoder (lzw_dec_init), the stored
+**  block is copied.
+**  
+**  Arguments:
+**      hdr   - header bytes;
+**      csize - output: size of block codes, 0 at the end of the frame;
+**      usize - output: size of uncompressed block data;
+**
+**  Return: 1 if the block is stored (csize bytes of uncompressed data),
+**          0 if not.
+******************************************************************************/
+int lzw_dec_block_hdr(const char hdr[LZW_BLOCK_HDR_SIZE], unsigned *csize, unsigned *usize)
+{
+	const unsigned size = lzw_dec_get32(hdr);
+
+	*csize = size & ~LZW_BLOCK_STORED;
+	*usize = lzw_dec_get32(hdr+4);
+
+	return (size & LZW_BLOCK_STORED) != 0;
+}
+
+/******************************************************************************
+**  lzw_dec_z_hdr
+**  --------------------------------------------------------------------------
+**  Parses the header of Unix compress (.Z) file. Only the block mode
+**  files (compress 3.0 and later) are supported.
+**  
+**  Arguments:
+**      hdr      - header bytes;
+**      max_bits - output: number of bits in the maximal code;
+**      flags    - output: stream flags, LZW_DIALECT_Z;
+**
+**  Return: 0 or LZW_ERR_FRAME if it is not a supported .Z file.
+******************************************************************************/
+int lzw_dec_z_hdr(const char hdr[LZW_Z_HDR_SIZE], unsigned *max_bits, unsigned *flags)
+{
+	const unsigned bits = (unsigned char)hdr[2] & 0x1f;
+
+	if (hdr[0] != LZW_Z_MAGIC[0] || hdr[1] != LZW_Z_MAGIC[1])
+		return LZW_ERR_FRAME;
+
+	if (!((unsigned char)hdr[2] & LZW_Z_BLOCK) || bits < LZW_Z_BITS_MIN || bits > LZW_Z_BITS || bits > DICT_BITS_MAX)
+		return LZW_ERR_FRAME;
+
+	*max_bits = bits;
+	*flags    = LZW_DIALECT_Z;
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_dec_frame_dict
+**  --------------------------------------------------------------------------
+**  Checks the primed dictionary of the framed stream (LZW_FRAME_DICT
+**  option): the ID after the frame header should be the dictionary ID.
+**  
+**  Arguments:
+**      hdr  - frame header bytes followed by the dictionary ID;
+**      dict - primed dictionary or NULL;
+**
+**  Return: 0 or LZW_ERR_DICT if it is not the dictionary of the stream.
+******************************************************************************/
+int lzw_dec_frame_dict(const char hdr[LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE], const char *dict)
+{
+	if (!dict || memcmp(hdr + LZW_FRAME_HDR_SIZE, dict + 4, LZW_FRAME_DICT_SIZE))
+		return LZW_ERR_DICT;
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_dec_get64
+**  --------------------------------------------------------------------------
+**  Loads 64-bit value stored in little-endian byte order.
+**  
+**  Arguments:
+**      p - input bytes;
+**
+**  Return: value
+******************************************************************************/
+static unsigned long long lzw_dec_get64(const char *const p)
+{
+	return lzw_dec_get32(p) | ((unsigned long long)lzw_dec_get32(p+4) << 32);
+}
+
+/******************************************************************************
+**  lzw_dec_index
+**  --------------------------------------------------------------------------
+**  Finds the block index of the framed stream (LZW_FRAME_INDEX option)
+**  by the trailer at the end of the stream.
+**  
+**  Arguments:
+**      frame   - framed stream from the frame header to the end of file;
+**      size    - size of the stream;
+**      nblocks - output: number of blocks;
+**
+**  Return: the first entry (nblocks + 1 entries) or NULL if there is no index.
+******************************************************************************/
+const char *lzw_dec_index(const char *frame, unsigned long long size, unsigned *nblocks)
+{
+	const char *trailer = frame + size - LZW_INDEX_TRAILER_SIZE;
+	unsigned   n;
+
+	if (size < LZW_FRAME_HDR_SIZE + LZW_INDEX_TRAILER_SIZE || !(frame[7] & LZW_FRAME_INDEX) ||
+		memcmp(trailer + 4, LZW_INDEX_MAGIC, 4))
+		return NULL;
+
+	n = lzw_dec_get32(trailer);
+
+	if ((size - LZW_FRAME_HDR_SIZE - LZW_INDEX_TRAILER_SIZE) / LZW_INDEX_ENTRY_SIZE < n + 1ull)
+		return NULL;
+
+	*nblocks = n;
+	return trailer - (n + 1ull) * LZW_INDEX_ENTRY_SIZE;
+}
+
+/******************************************************************************
+**  lzw_dec_index_entry
+**  --------------------------------------------------------------------------
+**  Parses an entry of the block index.
+**  
+**  Arguments:
+**      entry   - entry bytes;
+**      coffset - output: offset of the block header from the frame header;
+**      uoffset - output: uncompressed offset of the block;
+**
+**  Return: -
+******************************************************************************/
+void lzw_dec_index_entry(const char entry[LZW_INDEX_ENTRY_SIZE], unsigned long long *coffset, unsigned long long *uoffset)
+{
+	*coffset = lzw_dec_get64(entry);
+	*uoffset = lzw_dec_get64(entry+8);
+}
+
+// output of lzw_dec_range: the bytes in the range are passed to the sink
+typedef struct _lzw_dec_range
+{
+	lzw_write_t        write;	// sink of the context
+	void               *stream;	// application stream
+	unsigned long long pos;		// uncompressed offset of the next output byte
+	unsigned long long begin;	// range
+	unsigned long long end;
+}
+lzw_dec_range_t;
+
+static void lzw_dec_range_write(void *stream, char *buf, unsigned size)
+{
+	lzw_dec_range_t          *r   = (lzw_dec_range_t*)stream;
+	const unsigned long long pos  = r->pos;
+	unsigned long long       from = pos < r->begin ? r->begin : pos;
+	unsigned long long       to;
+
+	r->pos += size;
+	to = r->pos < r->end ? r->pos : r->end;
+
+	if (from < to)
+		r->write(r->stream, buf + (unsigned)(from - pos), (unsigned)(to - from));
+}
+
+/******************************************************************************
+**  lzw_dec_range
+**  --------------------------------------------------------------------------
+**  Decodes the byte range of the framed stream. Only the blocks covering
+**  the range are decoded, the first one is found by the binary search
+**  in the block index, the blocks of the stream without index are skipped
+**  by their headers. The stored blocks are copied. The context is set up
+**  for the blocks as for the whole frame (max bits, flags, primed
+**  dictionary), its sink gets the bytes of the range only.
+**  
+**  Arguments:
+**      ctx    - LZW decoder context;
+**      stream - Pointer to application defined output stream object;
+**      frame  - framed stream from the frame header to the end of file;
+**      size   - size of the stream;
+**      offset - uncompressed offset of the range;
+**      len    - length of the range, it ends at the end of the frame;
+**
+**  Return: 0 or error code: LZW_ERR_FRAME if the frame is broken or
+**          the context has other max bits or flags, LZW_ERR_DICT if it is
+**          not primed with the dictionary of the frame.
+******************************************************************************/
+int lzw_dec_range(lzw_dec_t *ctx, void *stream, const char *frame, unsigned long long size, unsigned long long offset, unsigned long long len)
+{
+	lzw_dec_range_t    r;
+	unsigned long long pos;
+	const char         *index;
+	unsigned           block_size, max_bits, flags, nblocks, csize, usize;
+	int                stored, ret = 0;
+
+	if (size < LZW_FRAME_HDR_SIZE || lzw_dec_frame_hdr(frame, &block_size, &max_bits, &flags) < 0)
+		return LZW_ERR_FRAME;
+
+	// the context is set up for the frame
+	if (flags & ~LZW_FLAG_LSB)
+		flags |= LZW_FLAG_CLEAR;
+	if (ctx->maxbits != max_bits || ctx->flags != flags)
+		return LZW_ERR_FRAME;
+
+	// the ID of the primed dictionary follows the header
+	if (frame[7] & LZW_FRAME_DICT ? !ctx->pmax || size < LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE ||
+		lzw_dec_get32(frame + LZW_FRAME_HDR_SIZE) != ctx->pid : ctx->pmax != 0)
+		return LZW_ERR_DICT;
+
+	r.write  = ctx->write;
+	r.stream = stream;
+	r.pos    = 0;
+	r.begin  = offset;
+	r.end    = len < ~0ull - offset ? offset + len : ~0ull;
+	pos      = LZW_FRAME_HDR_SIZE + (frame[7] & LZW_FRAME_DICT ? LZW_FRAME_DICT_SIZE : 0);
+
+	if ((index = lzw_dec_index(frame, size, &nblocks)) != NULL)
+	{
+		unsigned long long coffset, uoffset;
+		unsigned           lo = 0, hi = nblocks;
+
+		// the last block which starts before the range
+		while (hi - lo > 1)
+		{
+			const unsigned mid = lo + (hi - lo) / 2;
+
+			lzw_dec_index_entry(index + mid * LZW_INDEX_ENTRY_SIZE, &coffset, &uoffset);
+			if (uoffset <= offset)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		lzw_dec_index_entry(index + lo * LZW_INDEX_ENTRY_SIZE, &coffset, &uoffset);
+		pos   = coffset;
+		r.pos = uoffset;
+	}
+
+	while (r.pos < r.end)
+	{
+		if (pos > size || size - pos < LZW_BLOCK_HDR_SIZE) {
+			ret = LZW_ERR_FRAME;
+			break;
+		}
+
+		stored = lzw_dec_block_hdr(frame + pos, &csize, &usize);
+		pos   += LZW_BLOCK_HDR_SIZE;
+
+		// end of the frame
+		if (!csize)
+			break;
+
+		if (usize > block_size || size - pos < csize || (stored && csize != usize)) {
+			ret = LZW_ERR_FRAME;
+			break;
+		}
+
+		if (stored)
+			lzw_dec_range_write(&r, (char*)frame + pos, csize);
+		else if (r.pos + usize > r.begin)
+		{
+			const unsigned long long start = r.pos;
+
+			lzw_dec_init(ctx, &r);
+			ctx->write = lzw_dec_range_write;
+			ret = lzw_decode(ctx, (char*)frame + pos, csize);
+			ctx->write = r.write;
+
+			if (ret < 0)
+				break;
+
+			ret = (ret == csize && r.pos - start == usize) ? 0 : LZW_ERR_FRAME;
+			if (ret)
+				break;
+		}
+		else
+			r.pos += usize;
+
+		pos += csize;
+	}
+
+	ctx->stream = stream;
+
+	return ret;
+}
+
+/******************************************************************************
+**  lzw_dec_dict
+**  --------------------------------------------------------------------------
+**  Sets the primed dictionary trained by lzw_enc_train, the stream flags
+**  are set to the flags of the dictionary. The primed strings are written
+**  into the dictionary here once, lzw_dec_init and the resets only
+**  restart the codes after them. The strings are out of the output window,
+**  they are built by walking the dictionary. The dictionary is not kept.
+**  
+**  Arguments:
+**      ctx  - LZW decoder context;
+**      dict - primed dictionary or NULL to drop it;
+**      size - size of the dictionary;
+**
+**  Return: 0 or LZW_ERR_DICT if the dictionary does not fit the context.
+******************************************************************************/
+int lzw_dec_dict(lzw_dec_t *ctx, const char *dict, unsigned size)
+{
+	const unsigned char *p = (const unsigned char*)dict + LZW_DICT_HDR_SIZE;
+	unsigned            n, i, base, flags, max, codesize;
+
+	ctx->pmax = 0;
+
+	if (!dict)
+		return 0;
+
+	if (size < LZW_DICT_HDR_SIZE || memcmp(dict, LZW_DICT_MAGIC, 4) ||
+		(unsigned char)dict[8] != ctx->maxbits || ((unsigned char)dict[9] & ~LZW_FLAGS))
+		return LZW_ERR_DICT;
+
+	flags    = (unsigned char)dict[9];
+	flags    = flags & ~LZW_FLAG_LSB ? flags | LZW_FLAG_CLEAR : flags;
+	base     = LZW_CODE_LAST(flags);
+	codesize = flags & LZW_FLAG_CLEAR ? 9 : 8;
+	n        = lzw_dec_get32(dict + 12);
+
+	// the primed strings take up to half of the dictionary
+	if (n > (size - LZW_DICT_HDR_SIZE) / LZW_DICT_STR_SIZE || base + n >= (1u << (ctx->maxbits - 1)))
+		return LZW_ERR_DICT;
+
+	for (max = base, i = 0; i < n; i++, p += LZW_DICT_STR_SIZE)
+	{
+		const unsigned code = lzw_dec_get32((const char*)p);
+
+		// the prefix is a symbol or one of the previous strings
+		if (code > max || (code >= 256 && code <= base))
+			return LZW_ERR_DICT;
+
+		// the code size grows as if the strings were decoded
+		if (max + (flags & LZW_FLAG_EARLY ? 2 : 1) == (1u << codesize) && codesize < ctx->maxbits)
+			codesize++;
+
+		++max;
+		ctx->dict[max].prev = code;
+		ctx->dict[max].ch   = p[4];
+#if DEC_WINDOW
+		ctx->dict[max].len  = code < 256 ? 2 : ctx->dict[code].len + 1;
+		ctx->dict[max].pos  = ~0u;
+#endif
+	}
+
+	ctx->flags = flags;
+	ctx->pmax  = n ? max : 0;
+	ctx->psize = codesize;
+	ctx->pid   = lzw_dec_get32(dict + 4);
+
+	return 0;
 }
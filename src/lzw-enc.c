@@ -20,42 +20,161 @@
 ** with this program; if not, write to the Free Software Foundation, Inc.
 **
 ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
 #include "lzw.h"
 
 
+/******************************************************************************
+**  lzw_enc_store32
+**  --------------------------------------------------------------------------
+**  Stores 32-bit word into the code-buffer, the most significant byte first.
+**  
+**  Arguments:
+**      p    - output position, may be unaligned;
+**      bits - 32 bits to store;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_store32(unsigned char *const p, unsigned bits)
+{
+#ifdef LZW_BE32
+	bits = LZW_BE32(bits);
+	memcpy(p, &bits, 4);
+#else
+	p[0] = (unsigned char)(bits >> 24);
+	p[1] = (unsigned char)(bits >> 16);
+	p[2] = (unsigned char)(bits >> 8);
+	p[3] = (unsigned char)(bits);
+#endif
+}
+
+/******************************************************************************
+**  lzw_enc_store32le
+**  --------------------------------------------------------------------------
+**  Stores 32-bit word into the code-buffer, the least significant byte
+**  first (LZW_FLAG_LSB).
+**  
+**  Arguments:
+**      p    - output position, may be unaligned;
+**      bits - 32 bits to store;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_store32le(unsigned char *const p, unsigned bits)
+{
+#ifdef LZW_LE32
+	bits = LZW_LE32(bits);
+	memcpy(p, &bits, 4);
+#else
+	p[0] = (unsigned char)(bits);
+	p[1] = (unsigned char)(bits >> 8);
+	p[2] = (unsigned char)(bits >> 16);
+	p[3] = (unsigned char)(bits >> 24);
+#endif
+}
+
+/******************************************************************************
+**  lzw_enc_write
+**  --------------------------------------------------------------------------
+**  Writes the code-buffer into the output stream or into the output buffer
+**  of lzw_compress. The bytes which do not fit into the buffer are counted
+**  but not written.
+**  
+**  Arguments:
+**      ctx  - LZW encoder context;
+**      buf  - bytes to write;
+**      size - number of bytes;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_write(lzw_enc_t *const ctx, const unsigned char *buf, unsigned size)
+{
+	if (!ctx->dst) {
+		ctx->write(ctx->stream, (char*)buf, size);
+		return;
+	}
+
+	if (ctx->dsize + size <= ctx->dcap)
+		memcpy(ctx->dst + ctx->dsize, buf, size);
+
+	ctx->dsize += size;
+}
+
 /******************************************************************************
 **  lzw_enc_writebits
 **  --------------------------------------------------------------------------
 **  Write bits into bit-buffer.
-**  The number of bits should not exceed 24.
+**  The number of bits should not exceed 32. The 64-bit bit-buffer is
+**  flushed by whole 32-bit words, so the code-buffer bound is checked
+**  once per call. The flags are constant in the specialized loops.
 **  
 **  Arguments:
 **      ctx     - pointer to LZW context;
 **      bits    - bits to write;
-**      nbits   - number of bits to write, 0-24;
+**      nbits   - number of bits to write, 0-32;
+**      flags   - stream flags;
 **
 **  Return: -
 ******************************************************************************/
-static void lzw_enc_writebits(lzw_enc_t *const ctx, unsigned bits, unsigned nbits)
+__inline static void lzw_enc_writebits(lzw_enc_t *const ctx, unsigned bits, unsigned nbits, const unsigned flags)
 {
-	// shift old bits to the left, add new to the right
-	ctx->bb.buf = (ctx->bb.buf << nbits) | (bits & ((1 << nbits)-1));
+	LZW_STAT(ctx->stats.bits += nbits);
 
-	nbits += ctx->bb.n;
+	if (flags & LZW_FLAG_LSB)
+	{
+		// add new bits above the old ones
+		ctx->bb.buf |= (unsigned long long)(bits & ((1ULL << nbits)-1)) << ctx->bb.n;
+		ctx->bb.n   += nbits;
+
+		// flush whole word
+		if (ctx->bb.n < 32)
+			return;
 
-	// flush whole bytes
-	while (nbits >= 8)
+		ctx->bb.n -= 32;
+		lzw_enc_store32le(ctx->buff + ctx->lzwn, (unsigned)ctx->bb.buf);
+		ctx->bb.buf >>= 32;
+	}
+	else
 	{
-		nbits -= 8;
-		ctx->buff[ctx->lzwn++] = ctx->bb.buf >> nbits;
+		// shift old bits to the left, add new to the right
+		ctx->bb.buf = (ctx->bb.buf << nbits) | (bits & ((1ULL << nbits)-1));
+		ctx->bb.n  += nbits;
 
-		if (ctx->lzwn == sizeof(ctx->buff)) {
-			ctx->lzwn = 0;
-			lzw_writebuf(ctx->stream, ctx->buff, sizeof(ctx->buff));
-		}
+		// flush whole word
+		if (ctx->bb.n < 32)
+			return;
+
+		ctx->bb.n -= 32;
+		lzw_enc_store32(ctx->buff + ctx->lzwn, (unsigned)(ctx->bb.buf >> ctx->bb.n));
+	}
+
+	// the whole word is flushed
+	if ((ctx->lzwn += 4) == sizeof(ctx->buff)) {
+		ctx->lzwn = 0;
+		lzw_enc_write(ctx, ctx->buff, sizeof(ctx->buff));
 	}
+}
+
+/******************************************************************************
+**  lzw_enc_writecode
+**  --------------------------------------------------------------------------
+**  Writes the code of the current code size into bit-buffer. The codes
+**  are counted by their sizes, the padding bits are written by
+**  lzw_enc_writebits and are not.
+**  
+**  Arguments:
+**      ctx     - pointer to LZW context;
+**      code    - code to write;
+**      flags   - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_writecode(lzw_enc_t *const ctx, int code, const unsigned flags)
+{
+	LZW_STAT(ctx->stats.codes[ctx->codesize]++);
 
-	ctx->bb.n = nbits;
+	lzw_enc_writebits(ctx, code, ctx->codesize, flags);
 }
 
 /******************************************************************************
@@ -65,87 +184,316 @@ static void lzw_enc_writebits(lzw_enc_t *const ctx, unsigned bits, unsigned nbit
 **  in the hash table.
 **  
 **  Arguments:
+**      ctx  - LZW context;
 **      code - prefix code;
 **      c    - symbol;
+**      key  - <prefix>+<symbol> (ENC_PROBE);
 **
 **  Return: Hash code
 ******************************************************************************/
-__inline static int lzw_hash(const int code, const unsigned char c)
+#if ENC_PROBE
+__inline static unsigned lzw_hash(const lzw_enc_t *const ctx, const unsigned key)
+{
+	// multiplicative hash, the table has 2 << maxbits entries
+	return (key * 0x9E3779B1u) >> (31 - ctx->maxbits);
+}
+#else
+__inline static int lzw_hash(const lzw_enc_t *const ctx, const int code, const unsigned char c)
 {
-	return (code ^ ((int)c << 6)) & (HASH_SIZE-1);
+	return (code ^ ((int)c << 6)) & ((1 << ctx->maxbits)-1);
 }
+#endif
 
 /******************************************************************************
-**  lzw_enc_init
+**  lzw_enc_sink
 **  --------------------------------------------------------------------------
-**  Initializes LZW encoder context.
+**  Sets the output callback of the context, it is called with the stream
+**  of lzw_enc_init and the code bytes. The callback is kept by
+**  lzw_enc_init, so the contexts of one application may write into
+**  different kinds of streams.
 **  
 **  Arguments:
-**      ctx     - LZW context;
-**      stream  - Pointer to Input/Output stream object;
+**      ctx   - LZW encoder context;
+**      write - output callback or NULL for lzw_writebuf (LZW_WRITEBUF);
 **
 **  Return: -
 ******************************************************************************/
-void lzw_enc_init(lzw_enc_t *ctx, void *stream)
+void lzw_enc_sink(lzw_enc_t *ctx, lzw_write_t write)
 {
-	unsigned i;
+#if LZW_WRITEBUF
+	ctx->write = write ? write : lzw_writebuf;
+#else
+	ctx->write = write;
+#endif
+}
 
-	ctx->code     = CODE_NULL; // non-existent code
-	ctx->max      = 255;
-	ctx->codesize = 8;
-	ctx->stream   = stream;
-	ctx->bb.n     = 0; // bit-buffer init
-	ctx->lzwn     = 0; // output code-buffer init
+/******************************************************************************
+**  lzw_enc_create
+**  --------------------------------------------------------------------------
+**  Allocates LZW encoder context. The dictionary and the hash table are
+**  allocated together with the context and sized for the maximal code,
+**  the dense table of <root>+<symbol> strings has the fixed size.
+**  
+**  Arguments:
+**      max_bits - number of bits in the maximal code,
+**                 DICT_BITS_MIN..ENC_BITS_MAX;
+**
+**  Return: LZW encoder context or NULL. It should be freed by lzw_enc_destroy.
+******************************************************************************/
+#if ENC_ROOT
+#define ENC_ROOT_SIZE	(sizeof(root_enc_t) << 16)
+#else
+#define ENC_ROOT_SIZE	0
+#endif
+
+lzw_enc_t *lzw_enc_create(unsigned max_bits)
+{
+	lzw_enc_t *ctx;
+#if !ENC_PROBE
+	unsigned  i;
+#endif
+
+#if ENC_PROBE
+	// the key has 24 bits for the prefix code
+	if (max_bits < DICT_BITS_MIN || max_bits > ENC_BITS_MAX)
+		return NULL;
 
-	// clear hash table
-	for (i = 0; i < HASH_SIZE; i++)
-		ctx->hash[i] = CODE_NULL;
+	ctx = (lzw_enc_t*)malloc(sizeof(lzw_enc_t) + (sizeof(hash_enc_t) << (max_bits + 1)) + ENC_ROOT_SIZE);
 
-	for (i = 0; i < 256; i++)
+	if (ctx)
 	{
-		int hash = lzw_hash(CODE_NULL, i);
+		ctx->maxbits = max_bits;
+		ctx->flags   = 0;
+		ctx->dst     = NULL;
+		ctx->pdict   = NULL;
+		ctx->pn      = 0;
+		lzw_enc_sink(ctx, NULL);
+		ctx->dict    = NULL;
+		ctx->hash    = (hash_enc_t*)(ctx + 1);
+		// hash table is cleared only here, see lzw_enc_newgen
+		ctx->gen     = 0;
+		memset(ctx->hash, 0, sizeof(hash_enc_t) << (max_bits + 1));
+#if ENC_ROOT
+		ctx->root    = (root_enc_t*)(ctx->hash + (2 << max_bits));
+		memset(ctx->root, 0, ENC_ROOT_SIZE);
+#endif
+	}
+#else
+	if (max_bits < DICT_BITS_MIN || max_bits > DICT_BITS_MAX)
+		return NULL;
 
-		ctx->dict[i].prev  = CODE_NULL;
-		ctx->dict[i].next  = ctx->hash[hash];
-		ctx->dict[i].ch    = i;
-		ctx->hash[hash]    = i;
+	ctx = (lzw_enc_t*)malloc(sizeof(lzw_enc_t) + ((sizeof(node_enc_t) + sizeof(hash_enc_t)) << max_bits) + ENC_ROOT_SIZE);
+
+	if (ctx)
+	{
+		ctx->maxbits = max_bits;
+		ctx->flags   = 0;
+		ctx->dst     = NULL;
+		ctx->pdict   = NULL;
+		ctx->pn      = 0;
+		lzw_enc_sink(ctx, NULL);
+		ctx->dict    = (node_enc_t*)(ctx + 1);
+		ctx->hash    = (hash_enc_t*)(ctx->dict + (1 << max_bits));
+		// hash table is cleared only here, see lzw_enc_newgen
+		ctx->gen     = 0;
+		memset(ctx->hash, 0, sizeof(hash_enc_t) << max_bits);
+#if ENC_ROOT
+		ctx->root    = (root_enc_t*)(ctx->hash + (1 << max_bits));
+		memset(ctx->root, 0, ENC_ROOT_SIZE);
+#endif
+		// the root strings are never overwritten, lzw_enc_init keeps them
+		for (i = 0; i < 256; i++)
+		{
+			ctx->dict[i].prev  = CODE_NULL;
+			ctx->dict[i].ch    = i;
+		}
 	}
+#endif
+
+	return ctx;
 }
 
 /******************************************************************************
-**  lzw_enc_reset
+**  lzw_enc_destroy
 **  --------------------------------------------------------------------------
-**  Reset LZW encoder context. Used when the dictionary overflows.
-**  Code size set to 8 bit.
+**  Frees LZW encoder context allocated by lzw_enc_create.
 **  
 **  Arguments:
-**      ctx     - LZW encoder context;
+**      ctx - LZW encoder context;
 **
 **  Return: -
 ******************************************************************************/
-static void lzw_enc_reset(lzw_enc_t *const ctx)
+void lzw_enc_destroy(lzw_enc_t *ctx)
 {
-	unsigned i;
+	free(ctx);
+}
 
-#if DEBUG
-	printf("reset\n");
+/******************************************************************************
+**  lzw_enc_flags
+**  --------------------------------------------------------------------------
+**  Sets the stream flags (LZW_FLAG_*) or the dialect (LZW_DIALECT_*).
+**  The flags are not stored in the raw stream so the decoder should use
+**  the same flags. They take effect at the next lzw_enc_init.
+**  The primed dictionary (lzw_enc_dict) is dropped.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_flags(lzw_enc_t *ctx, unsigned flags)
+{
+	ctx->flags = flags & ~LZW_FLAG_LSB ? flags | LZW_FLAG_CLEAR : flags;
+	ctx->pdict = NULL;
+	ctx->pn    = 0;
+}
+
+/******************************************************************************
+**  lzw_enc_newgen
+**  --------------------------------------------------------------------------
+**  Starts new dictionary generation. Hash table and dense table entries
+**  of the previous generations are treated as empty, so the tables are
+**  not cleared. The tables do not contain the single-symbol strings,
+**  so the new generation is empty. The 8-bit generation tag of the open
+**  addressing table wraps more often so the table is cleared every 255
+**  generations.
+**  
+**  Arguments:
+**      ctx     - LZW encoder context;
+**
+**  Return: -
+******************************************************************************/
+#if ENC_PROBE
+static void lzw_enc_newgen(lzw_enc_t *const ctx)
+{
+	// generation counter wraps - clear hash table
+	if (++ctx->gen == 256)
+	{
+		memset(ctx->hash, 0, sizeof(hash_enc_t) << (ctx->maxbits + 1));
+#if ENC_ROOT
+		memset(ctx->root, 0, ENC_ROOT_SIZE);
+#endif
+		ctx->gen = 1;
+	}
+}
+#else
+static void lzw_enc_newgen(lzw_enc_t *const ctx)
+{
+	// generation counter wraps - clear hash table
+	if (++ctx->gen == 0)
+	{
+		memset(ctx->hash, 0, sizeof(hash_enc_t) << ctx->maxbits);
+#if ENC_ROOT
+		memset(ctx->root, 0, ENC_ROOT_SIZE);
+#endif
+		ctx->gen = 1;
+	}
+}
 #endif
 
-	ctx->max      = 255;
-	ctx->codesize = 8;
+#if LZW_STATS
+/******************************************************************************
+**  lzw_enc_stat_find
+**  --------------------------------------------------------------------------
+**  Counts a hash table search.
+**  
+**  Arguments:
+**      ctx - LZW encoder context;
+**      n   - number of visited chain nodes or table entries;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_stat_find(lzw_enc_t *const ctx, unsigned n)
+{
+	ctx->stats.finds++;
+	ctx->stats.probes += n;
+	if (ctx->stats.probe_max < n)
+		ctx->stats.probe_max = n;
+}
+#endif
 
-	for (i = 0; i < HASH_SIZE; i++)
-		ctx->hash[i] = CODE_NULL;
+#if ENC_PROBE
+/******************************************************************************
+**  lzw_enc_findstr
+**  --------------------------------------------------------------------------
+**  Searches a string in LZW dictionaly. It is used only in encoder.
+**  The <prefix>+<symbol> key is searched in the open addressing hash table
+**  by linear probing. An entry of the previous generation ends the search.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - code for the string beginning (already in dictionary);
+**      c    - last symbol;
+**
+**  Return: code representing the string or CODE_NULL.
+******************************************************************************/
+static int lzw_enc_findstr(lzw_enc_t *const ctx, int code, unsigned char c)
+{
+	const unsigned key  = ((unsigned)code << 8) | c;
+	const unsigned mask = (2u << ctx->maxbits) - 1;
+	unsigned       i;
+	int            nc;
+#if LZW_STATS
+	unsigned       n = 0;
+#endif
 
-	for (i = 0; i < 256; i++)
+	for (i = lzw_hash(ctx, key);; i = (i + 1) & mask)
 	{
-		int hash = lzw_hash(CODE_NULL, i);
+		const hash_enc_t *hash = &ctx->hash[i];
+
+		LZW_STAT(n++);
+
+		if ((hash->val >> 24) != ctx->gen) {
+			nc = CODE_NULL;
+			break;
+		}
 
-		ctx->dict[i].next  = ctx->hash[hash];
-		ctx->hash[hash]    = i;
+		if (hash->key == key) {
+			nc = hash->val & 0xFFFFFF;
+			break;
+		}
 	}
+
+	LZW_STAT(lzw_enc_stat_find(ctx, n));
+
+	return nc;
 }
 
+/******************************************************************************
+**  lzw_enc_addstr
+**  --------------------------------------------------------------------------
+**  Adds string to the LZW dictionaly. The string is stored into the first
+**  free entry of the open addressing hash table.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - code for the string beginning (already in dictionary);
+**      c    - last symbol;
+**
+**  Return: code representing the string or CODE_NULL if dictionary is full.
+******************************************************************************/
+static int lzw_enc_addstr(lzw_enc_t *const ctx, int code, unsigned char c)
+{
+	const unsigned key  = ((unsigned)code << 8) | c;
+	const unsigned mask = (2u << ctx->maxbits) - 1;
+	unsigned       i;
+
+	if (++ctx->max == (1u << ctx->maxbits))
+		return CODE_NULL;
+
+	for (i = lzw_hash(ctx, key); (ctx->hash[i].val >> 24) == ctx->gen; i = (i + 1) & mask)
+		;
+
+	ctx->hash[i].key = key;
+	ctx->hash[i].val = (ctx->gen << 24) | ctx->max;
+#if DEBUG
+	printf("add code %x = %x + %c\n", ctx->max, code, c);
+#endif
+
+	return ctx->max;
+}
+#else
 /******************************************************************************
 **  lzw_enc_findstr
 **  --------------------------------------------------------------------------
@@ -162,16 +510,30 @@ static void lzw_enc_reset(lzw_enc_t *const ctx)
 ******************************************************************************/
 static int lzw_enc_findstr(lzw_enc_t *const ctx, int code, unsigned char c)
 {
-	int nc;
+	const hash_enc_t *hash = &ctx->hash[lzw_hash(ctx, code, c)];
+	int              nc;
+#if LZW_STATS
+	unsigned         n = 0;
+#endif
+
+	// the entry is left from the previous generation
+	if (hash->gen != ctx->gen) {
+		LZW_STAT(lzw_enc_stat_find(ctx, 0));
+		return CODE_NULL;
+	}
 
 	// hash search
-	for (nc = ctx->hash[lzw_hash(code,c)]; nc != CODE_NULL; nc = ctx->dict[nc].next)
+	for (nc = hash->code; nc != CODE_NULL; nc = ctx->dict[nc].next)
 	{
+		LZW_STAT(n++);
+
 		if (ctx->dict[nc].prev == code && ctx->dict[nc].ch == c) {
 			break;
 		}
 	}
 
+	LZW_STAT(lzw_enc_stat_find(ctx, n));
+
 	return nc;
 }
 
@@ -189,100 +551,1475 @@ static int lzw_enc_findstr(lzw_enc_t *const ctx, int code, unsigned char c)
 ******************************************************************************/
 static int lzw_enc_addstr(lzw_enc_t *const ctx, int code, unsigned char c)
 {
-	int hash;
+	hash_enc_t *hash;
 
-	if (++ctx->max == CODE_NULL)
+	if (++ctx->max == (1u << ctx->maxbits))
 		return CODE_NULL;
 
-	hash = lzw_hash(code, c);
+	hash = &ctx->hash[lzw_hash(ctx, code, c)];
 
 	// add new code
 	ctx->dict[ctx->max].prev  = code;
-	ctx->dict[ctx->max].next  = ctx->hash[hash];
+	ctx->dict[ctx->max].next  = hash->gen == ctx->gen ? hash->code : CODE_NULL;
 	ctx->dict[ctx->max].ch    = c;
 	// add the new code into hash table
-	ctx->hash[hash] = ctx->max;
+	hash->code = ctx->max;
+	hash->gen  = ctx->gen;
 #if DEBUG
 	printf("add code %x = %x + %c\n", ctx->max, code, c);
 #endif
 
 	return ctx->max;
 }
+#endif
 
+#if ENC_ROOT
 /******************************************************************************
-**  lzw_encode
+**  lzw_enc_findroot
 **  --------------------------------------------------------------------------
-**  Encode buffer by LZW algorithm. The output data is written by application
-**  specific callback to the application defined stream inside this function.
+**  Searches <root>+<symbol> string in the dense table. This is the first
+**  search after every written code and it needs no hashing.
 **  
 **  Arguments:
-**      ctx  - LZW encoder context;
-**      buf  - input byte buffer;
-**      size - size of the buffer;
+**      ctx  - LZW context;
+**      code - single-symbol string code 0..255;
+**      c    - last symbol;
 **
-**  Return: Number of processed bytes.
+**  Return: code representing the string or CODE_NULL.
 ******************************************************************************/
-int lzw_encode(lzw_enc_t *ctx, char buf[], unsigned size)
+__inline static int lzw_enc_findroot(lzw_enc_t *const ctx, int code, unsigned char c)
 {
-	unsigned i;
+	const root_enc_t *root = &ctx->root[(code << 8) | c];
 
-	if (!size) return 0;
+	LZW_STAT(ctx->stats.roots++);
 
-	for (i = 0; i < size; i++)
-	{
-		unsigned char c = buf[i];
-		int           nc = lzw_enc_findstr(ctx, ctx->code, c);
+	return root->gen == ctx->gen ? root->code : CODE_NULL;
+}
 
-		if (nc == CODE_NULL)
-		{
-			// the string was not found - write <prefix>
-			lzw_enc_writebits(ctx, ctx->code, ctx->codesize);
+/******************************************************************************
+**  lzw_enc_addroot
+**  --------------------------------------------------------------------------
+**  Adds <root>+<symbol> string to the LZW dictionaly.
+**  The hash table does not contain such strings.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - single-symbol string code 0..255;
+**      c    - last symbol;
+**
+**  Return: code representing the string or CODE_NULL if dictionary is full.
+******************************************************************************/
+__inline static int lzw_enc_addroot(lzw_enc_t *const ctx, int code, unsigned char c)
+{
+	root_enc_t *root = &ctx->root[(code << 8) | c];
+
+	if (++ctx->max == (1u << ctx->maxbits))
+		return CODE_NULL;
+
+	root->code = ctx->max;
+	root->gen  = ctx->gen;
 #if DEBUG
-			printf("code %x (%d)\n", ctx->code, ctx->codesize);
+	printf("add code %x = %x + %c\n", ctx->max, code, c);
 #endif
-			// increase the code size (number of bits) if needed
-			if (ctx->max+1 == (1 << ctx->codesize))
-				ctx->codesize++;
 
-			// add <prefix>+<current symbol> to the dictionary
-			if (lzw_enc_addstr(ctx, ctx->code, c) == CODE_NULL)
-			{
-				// dictionary is full - reset encoder
-				lzw_enc_reset(ctx);
-			}
-
-			ctx->code = c;
-		}
-		else
-		{
-			ctx->code = nc;
-		}
-	}
+	return ctx->max;
+}
+#endif
 
-	return size;
+/******************************************************************************
+**  lzw_enc_get32
+**  --------------------------------------------------------------------------
+**  Loads 32-bit value in little-endian byte order.
+**  
+**  Arguments:
+**      p - input bytes;
+**
+**  Return: value
+******************************************************************************/
+static unsigned lzw_enc_get32(const unsigned char *const p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
 }
 
 /******************************************************************************
-**  lzw_enc_end
+**  lzw_enc_prime
 **  --------------------------------------------------------------------------
-**  Finish LZW encoding process. As output data is written into output stream
-**  via bit-buffer it can contain unsaved data. This function flushes
-**  bit-buffer and padds last byte with zero bits.
+**  Adds the strings of the primed dictionary to the fresh dictionary.
+**  The hash table entries are tagged with the dictionary generation,
+**  so only the primed strings are inserted and nothing is cleared.
+**  The code size grows as if the strings were encoded.
 **  
 **  Arguments:
-**      ctx  - LZW encoder context;
+**      ctx     - LZW encoder context;
 **
 **  Return: -
 ******************************************************************************/
-void lzw_enc_end(lzw_enc_t *ctx)
+static void lzw_enc_prime(lzw_enc_t *const ctx)
 {
-#if DEBUG
-	printf("code %x (%d)\n", ctx->code, ctx->codesize);
+	const unsigned char *p = ctx->pdict + LZW_DICT_HDR_SIZE;
+	unsigned            i;
+
+	for (i = 0; i < ctx->pn; i++, p += LZW_DICT_STR_SIZE)
+	{
+		const int code = (int)lzw_enc_get32(p);
+
+		if (ctx->max + (ctx->flags & LZW_FLAG_EARLY ? 2 : 1) == (1u << ctx->codesize) && ctx->codesize < ctx->maxbits)
+			ctx->codesize++;
+#if ENC_ROOT
+		if (code < 256) {
+			lzw_enc_addroot(ctx, code, p[4]);
+			continue;
+		}
 #endif
-	// write last code
-	lzw_enc_writebits(ctx, ctx->code, ctx->codesize);
-	// flush bits in the bit-buffer
-	if (ctx->bb.n)
-		lzw_enc_writebits(ctx, 0, 8 - ctx->bb.n);
-	lzw_writebuf(ctx->stream, ctx->buff, ctx->lzwn);
+		lzw_enc_addstr(ctx, code, p[4]);
+	}
+}
+
+/******************************************************************************
+**  lzw_enc_init
+**  --------------------------------------------------------------------------
+**  Initializes LZW encoder context created by lzw_enc_create.
+**  The primed dictionary (lzw_enc_dict) is added to the fresh one.
+**  
+**  Arguments:
+**      ctx     - LZW context;
+**      stream  - Pointer to Input/Output stream object;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_init(lzw_enc_t *ctx, void *stream)
+{
+	ctx->code     = CODE_NULL; // non-existent code
+	// codes 256..258 are reserved for CLEAR, EOI and SYNC codes
+	ctx->max      = LZW_CODE_LAST(ctx->flags);
+	ctx->codesize = ctx->flags & LZW_FLAG_CLEAR ? 9 : 8;
+	ctx->stream   = stream;
+	ctx->bb.n     = 0; // bit-buffer init
+	ctx->bb.buf   = 0;
+	ctx->lzwn     = 0; // output code-buffer init
+	ctx->outf     = 0;
+	ctx->ipos     = 0; // compression ratio monitor init
+	ctx->opos     = 0;
+	ctx->ibase    = 0;
+	ctx->obase    = 0;
+	ctx->check    = 0;
+	ctx->ratio    = 0;
+	ctx->gbase    = 0;
+	ctx->end      = 0;
+#if ENC_RUN
+	ctx->rn       = 0;
+#endif
+#if LZW_STATS
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+#endif
+
+	lzw_enc_newgen(ctx);
+	lzw_enc_prime(ctx);
+
+	// the dialects with EOI code start with CLEAR code
+	if (ctx->flags & LZW_FLAG_EOI)
+	{
+		lzw_enc_writecode(ctx, LZW_CODE_CLEAR, ctx->flags);
+		ctx->opos += ctx->codesize;
+	}
+}
+
+/******************************************************************************
+**  lzw_enc_reset
+**  --------------------------------------------------------------------------
+**  Reset LZW encoder context. Used when the dictionary overflows
+**  or after CLEAR code. Code size set to 8 bit (9 bit with CLEAR code),
+**  the dictionary gets the primed strings again.
+**  
+**  Arguments:
+**      ctx     - LZW encoder context;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_reset(lzw_enc_t *const ctx)
+{
+#if DEBUG
+	printf("reset\n");
+#endif
+	LZW_STAT(ctx->stats.resets++);
+#if ENC_RUN
+	ctx->rn       = 0;
+#endif
+
+	ctx->max      = LZW_CODE_LAST(ctx->flags);
+	ctx->codesize = ctx->flags & LZW_FLAG_CLEAR ? 9 : 8;
+
+	lzw_enc_newgen(ctx);
+	lzw_enc_prime(ctx);
+}
+
+/******************************************************************************
+**  lzw_enc_align
+**  --------------------------------------------------------------------------
+**  Pads the group of 8 codes with zero bits before the code size changes
+**  (LZW_FLAG_GROUP). Unix compress reads the codes by groups of the code
+**  size bytes.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_align(lzw_enc_t *const ctx, const unsigned flags)
+{
+	const unsigned group = ctx->codesize * 8;
+	unsigned       pad   = (unsigned)((group - (ctx->opos - ctx->gbase) % group) % group);
+
+	ctx->opos += pad;
+	ctx->gbase = ctx->opos;
+
+	for (; pad > 24; pad -= 24)
+		lzw_enc_writebits(ctx, 0, 24, flags);
+	lzw_enc_writebits(ctx, 0, pad, flags);
+}
+
+/******************************************************************************
+**  lzw_enc_clear
+**  --------------------------------------------------------------------------
+**  Writes CLEAR code and resets the dictionary.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_clear(lzw_enc_t *const ctx, const unsigned flags)
+{
+	lzw_enc_writecode(ctx, LZW_CODE_CLEAR, flags);
+	ctx->opos += ctx->codesize;
+	LZW_STAT(ctx->stats.clears++);
+#if DEBUG
+	printf("code %x (%d)\n", LZW_CODE_CLEAR, ctx->codesize);
+#endif
+	if (flags & LZW_FLAG_GROUP)
+		lzw_enc_align(ctx, flags);
+
+	lzw_enc_reset(ctx);
+}
+
+/******************************************************************************
+**  lzw_enc_check
+**  --------------------------------------------------------------------------
+**  Checks the compression ratio of the full dictionary (LZW_FLAG_CLEAR).
+**  The ratio is measured since the dictionary reset. If it did not grow
+**  since the previous check the dictionary does not fit the data anymore:
+**  CLEAR code is written and the dictionary is reset.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      ipos  - number of input bytes;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_check(lzw_enc_t *const ctx, unsigned long long ipos, const unsigned flags)
+{
+	// input bytes per output byte, 8-bit fraction
+	unsigned long long ratio = ((ipos - ctx->ibase) << 8) / ((ctx->opos - ctx->obase) / 8 + 1);
+
+	ctx->check = ipos + ENC_CHECK_GAP;
+
+	if (ratio > ctx->ratio) {
+		ctx->ratio = ratio;
+		return;
+	}
+
+	lzw_enc_clear(ctx, flags);
+
+	ctx->ibase = ipos;
+	ctx->obase = ctx->opos;
+	ctx->ratio = 0;
+}
+
+/******************************************************************************
+**  lzw_enc_find
+**  --------------------------------------------------------------------------
+**  Searches <prefix>+<symbol> string in the dense table (ENC_ROOT)
+**  or in the hash table.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - code for the string beginning or CODE_NULL;
+**      c    - last symbol;
+**
+**  Return: code representing the string or CODE_NULL.
+******************************************************************************/
+__inline static int lzw_enc_find(lzw_enc_t *const ctx, int code, unsigned char c)
+{
+#if ENC_ROOT
+	return (unsigned)code < 256 ? lzw_enc_findroot(ctx, code, c) : lzw_enc_findstr(ctx, code, c);
+#else
+	return lzw_enc_findstr(ctx, code, c);
+#endif
+}
+
+/******************************************************************************
+**  lzw_enc_grow
+**  --------------------------------------------------------------------------
+**  Increases the code size (number of bits) after the written code
+**  if the next code may not fit. The early change (LZW_FLAG_EARLY)
+**  increases it one code earlier.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_grow(lzw_enc_t *const ctx, const unsigned flags)
+{
+	if (ctx->max + (flags & LZW_FLAG_EARLY ? 2 : 1) == (1u << ctx->codesize) && ctx->codesize < ctx->maxbits)
+	{
+		if (flags & LZW_FLAG_GROUP)
+			lzw_enc_align(ctx, flags);
+
+		ctx->codesize++;
+	}
+}
+
+/******************************************************************************
+**  lzw_enc_miss
+**  --------------------------------------------------------------------------
+**  The string <current code>+<symbol> is not in the dictionary: writes
+**  the current code, adds the string to the dictionary and starts
+**  the next string from the symbol.
+**  With EOI code (LZW_FLAG_EOI) the dictionary is cleared where
+**  the GIF and TIFF encoders do it: before the code 4095 (4093 with
+**  the early change) of the 12-bit dictionary.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      c     - current symbol;
+**      ipos  - position of the symbol in the input stream;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_miss(lzw_enc_t *const ctx, unsigned char c, unsigned long long ipos, const unsigned flags)
+{
+	int nc;
+
+	// the string was not found - write <prefix>
+	lzw_enc_writecode(ctx, ctx->code, flags);
+	ctx->opos += ctx->codesize;
+#if DEBUG
+	printf("code %x (%d)\n", ctx->code, ctx->codesize);
+#endif
+	// increase the code size (number of bits) if needed
+	lzw_enc_grow(ctx, flags);
+
+	// add <prefix>+<current symbol> to the dictionary
+	if ((flags & LZW_FLAG_EOI) && ctx->max+1 >= (1u << ctx->maxbits) - (flags & LZW_FLAG_EARLY ? 3 : 1))
+	{
+		// the dictionary is never full
+		lzw_enc_clear(ctx, flags);
+	}
+	else if (ctx->max+1 == (1u << ctx->maxbits) && (flags & LZW_FLAG_CLEAR))
+	{
+		// the full dictionary is kept while it compresses well
+		if (ipos >= ctx->check)
+			lzw_enc_check(ctx, ipos, flags);
+	}
+#if ENC_ROOT
+	else if ((nc = (unsigned)ctx->code < 256 ?
+		lzw_enc_addroot(ctx, ctx->code, c) : lzw_enc_addstr(ctx, ctx->code, c)) == CODE_NULL)
+#else
+	else if ((nc = lzw_enc_addstr(ctx, ctx->code, c)) == CODE_NULL)
+#endif
+	{
+		// dictionary is full - reset encoder
+		lzw_enc_reset(ctx);
+	}
+#if ENC_RUN
+	// the new string continues the memorized run
+	else if (ctx->rn && c == ctx->rch && ctx->code == ctx->run[ctx->rn-1] && ctx->rn < ENC_RUN)
+	{
+		ctx->run[ctx->rn++] = nc;
+	}
+#endif
+
+	ctx->code = c;
+}
+
+#if ENC_RUN
+/******************************************************************************
+**  lzw_enc_runlen
+**  --------------------------------------------------------------------------
+**  Counts the leading symbols of the buffer equal to the given one,
+**  compares 8 bytes at once.
+**  
+**  Arguments:
+**      buf  - input buffer;
+**      c    - run symbol;
+**      size - size of the buffer;
+**
+**  Return: run length.
+******************************************************************************/
+__inline static unsigned lzw_enc_runlen(const char *buf, unsigned char c, unsigned size)
+{
+	const unsigned long long w = 0x0101010101010101ULL * c;
+	unsigned long long       v;
+	unsigned                 n = 0;
+
+	for (; n + 8 <= size; n += 8)
+	{
+		memcpy(&v, buf + n, 8);
+		if (v != w)
+			break;
+	}
+
+	while (n < size && (unsigned char)buf[n] == c)
+		n++;
+
+	return n;
+}
+
+/******************************************************************************
+**  lzw_enc_run
+**  --------------------------------------------------------------------------
+**  Encodes a run of the current symbol. The run strings <c>, <c><c>, ...
+**  are memorized, the longest of them is always the longest run string
+**  in the dictionary (unless there are ENC_RUN strings). So the run
+**  is encoded without searching: the encoder goes to the end of the run
+**  or to the longest run string where the next search definitely fails.
+**  The output is the same as the output of the per-symbol searches.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context, the current code is the symbol buf[i];
+**      buf   - input buffer;
+**      i     - position of the symbol;
+**      size  - size of the buffer;
+**      flags - stream flags;
+**
+**  Return: position of the last encoded symbol.
+******************************************************************************/
+__inline static unsigned lzw_enc_run(lzw_enc_t *const ctx, const char buf[], unsigned i, unsigned size, const unsigned flags)
+{
+	const unsigned char c   = buf[i];
+	const unsigned      end = i + 1 + lzw_enc_runlen(buf + i + 1, c, size - i - 1);
+	unsigned            k   = 1;	// current code is the run string of k symbols
+
+	// short runs are left to the searches
+	if (end - i < 8)
+		return i;
+
+	// memorize the run strings of the dictionary
+	if (!ctx->rn || ctx->rch != c)
+	{
+		int nc;
+
+		ctx->rch    = c;
+		ctx->run[0] = c;
+		for (ctx->rn = 1; ctx->rn < ENC_RUN; ctx->rn++)
+		{
+			if ((nc = lzw_enc_find(ctx, ctx->run[ctx->rn-1], c)) == CODE_NULL)
+				break;
+			ctx->run[ctx->rn] = nc;
+		}
+	}
+
+	// the run is reset with the dictionary
+	while (ctx->rn)
+	{
+		// the rest of the run is a known string
+		if (k + (end - i - 1) <= ctx->rn) {
+			ctx->code = ctx->run[k + (end - i - 1) - 1];
+			return end - 1;
+		}
+
+		// go to the longest run string
+		i        += ctx->rn - k;
+		ctx->code = ctx->run[ctx->rn-1];
+
+		// there may be longer run strings
+		if (ctx->rn == ENC_RUN)
+			break;
+
+		// the next symbol is not found
+		lzw_enc_miss(ctx, c, ctx->ipos + ++i, flags);
+		k = 1;
+	}
+
+	return i;
+}
+#endif
+
+/******************************************************************************
+**  lzw_enc_loop
+**  --------------------------------------------------------------------------
+**  Encoding loop of lzw_encode. It is inlined with constant stream flags
+**  for every dialect, so the dialect checks are resolved at compile time.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      buf   - input byte buffer;
+**      size  - size of the buffer;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_loop(lzw_enc_t *const ctx, const char buf[], unsigned size, const unsigned flags)
+{
+	unsigned i = 0;
+
+	// the first symbol of the stream is the single-symbol string
+	if (ctx->code == CODE_NULL)
+		ctx->code = (unsigned char)buf[i++];
+
+	for (; i < size; i++)
+	{
+		unsigned char c  = buf[i];
+		int           nc = lzw_enc_find(ctx, ctx->code, c);
+
+		if (nc == CODE_NULL)
+		{
+			lzw_enc_miss(ctx, c, ctx->ipos + i, flags);
+#if ENC_RUN
+			// a run of the symbol may follow
+			if (i+1 < size && (unsigned char)buf[i+1] == c)
+				i = lzw_enc_run(ctx, buf, i, size, flags);
+#endif
+		}
+		else
+		{
+			ctx->code = nc;
+		}
+	}
+}
+
+/******************************************************************************
+**  lzw_encode
+**  --------------------------------------------------------------------------
+**  Encode buffer by LZW algorithm. The output data is written by application
+**  specific callback to the application defined stream inside this function.
+**  
+**  Arguments:
+**      ctx  - LZW encoder context;
+**      buf  - input byte buffer;
+**      size - size of the buffer;
+**
+**  Return: Number of processed bytes.
+******************************************************************************/
+int lzw_encode(lzw_enc_t *ctx, char buf[], unsigned size)
+{
+	if (!size) return 0;
+
+	switch (ctx->flags)
+	{
+	case 0:
+		lzw_enc_loop(ctx, buf, size, 0);
+		break;
+	case LZW_FLAG_CLEAR:
+		lzw_enc_loop(ctx, buf, size, LZW_FLAG_CLEAR);
+		break;
+	case LZW_DIALECT_Z:
+		lzw_enc_loop(ctx, buf, size, LZW_DIALECT_Z);
+		break;
+	case LZW_DIALECT_GIF:
+		lzw_enc_loop(ctx, buf, size, LZW_DIALECT_GIF);
+		break;
+	case LZW_DIALECT_TIFF:
+		lzw_enc_loop(ctx, buf, size, LZW_DIALECT_TIFF);
+		break;
+	default:
+		lzw_enc_loop(ctx, buf, size, ctx->flags);
+	}
+
+	ctx->ipos += size;
+	LZW_STAT(ctx->stats.in += size);
+
+	return size;
+}
+
+#if ENC_BATCH > 1
+/******************************************************************************
+**  lzw_enc_prefetch
+**  --------------------------------------------------------------------------
+**  Prefetches the dense table or hash table entry which lzw_enc_find
+**  reads first for <prefix>+<symbol> string.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - code for the string beginning;
+**      c    - last symbol;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_prefetch(const lzw_enc_t *const ctx, int code, unsigned char c)
+{
+#if ENC_ROOT
+	if ((unsigned)code < 256) {
+		LZW_PREFETCH(&ctx->root[(code << 8) | c]);
+		return;
+	}
+#endif
+#if ENC_PROBE
+	LZW_PREFETCH(&ctx->hash[lzw_hash(ctx, ((unsigned)code << 8) | c)]);
+#else
+	LZW_PREFETCH(&ctx->hash[lzw_hash(ctx, code, c)]);
+#endif
+}
+
+#if !ENC_PROBE
+/******************************************************************************
+**  lzw_enc_prefetch_node
+**  --------------------------------------------------------------------------
+**  Prefetches the first dictionary node of the hash chain which
+**  lzw_enc_findstr visits for <prefix>+<symbol> string. The hash table
+**  entry should be prefetched before by lzw_enc_prefetch.
+**  
+**  Arguments:
+**      ctx  - LZW context;
+**      code - code for the string beginning;
+**      c    - last symbol;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_prefetch_node(const lzw_enc_t *const ctx, int code, unsigned char c)
+{
+	const hash_enc_t *hash = &ctx->hash[lzw_hash(ctx, code, c)];
+
+#if ENC_ROOT
+	if ((unsigned)code < 256)
+		return;
+#endif
+	if (hash->gen == ctx->gen && hash->code != CODE_NULL)
+		LZW_PREFETCH(&ctx->dict[hash->code]);
+}
+#endif
+
+/******************************************************************************
+**  lzw_enc_batch_loop
+**  --------------------------------------------------------------------------
+**  Encoding loop of lzw_encode_batch. Up to ENC_BATCH streams are encoded
+**  together, one symbol of every stream per round. The round first
+**  prefetches the table entries of the next searches of all streams,
+**  then the first chain nodes they point to, and then encodes the symbols:
+**  the misses of the streams overlap instead of following each other.
+**  A finished stream is replaced with the next one. It is inlined like
+**  lzw_enc_loop.
+**  
+**  Arguments:
+**      ctx   - LZW encoder contexts;
+**      buf   - input byte buffers;
+**      size  - sizes of the buffers;
+**      n     - number of streams;
+**      flags - stream flags;
+**
+**  Return: -
+******************************************************************************/
+__inline static void lzw_enc_batch_loop(lzw_enc_t *const ctx[], char *const buf[], const unsigned size[], unsigned n, const unsigned flags)
+{
+	unsigned slot[ENC_BATCH];	// streams being encoded
+	unsigned pos[ENC_BATCH];	// positions of their next symbols
+	unsigned m    = 0;			// number of streams being encoded
+	unsigned next = 0;			// next stream to start
+	unsigned k;
+
+	for (;;)
+	{
+		// start the next streams in the free slots
+		for (; m < ENC_BATCH && next < n; next++)
+		{
+			lzw_enc_t *const e = ctx[next];
+			unsigned         i = 0;
+
+			if (!size[next])
+				continue;
+
+			// the first symbol of the stream is the single-symbol string
+			if (e->code == CODE_NULL)
+				e->code = (unsigned char)buf[next][i++];
+
+			if (i < size[next]) {
+				slot[m]  = next;
+				pos[m++] = i;
+			}
+			else {
+				e->ipos += size[next];
+				LZW_STAT(e->stats.in += size[next]);
+			}
+		}
+
+		if (!m)
+			break;
+
+		for (k = 0; k < m; k++)
+			lzw_enc_prefetch(ctx[slot[k]], ctx[slot[k]]->code, buf[slot[k]][pos[k]]);
+#if !ENC_PROBE
+		for (k = 0; k < m; k++)
+			lzw_enc_prefetch_node(ctx[slot[k]], ctx[slot[k]]->code, buf[slot[k]][pos[k]]);
+#endif
+
+		for (k = 0; k < m;)
+		{
+			const unsigned   s  = slot[k];
+			lzw_enc_t *const e  = ctx[s];
+			const char       *b = buf[s];
+			unsigned         i  = pos[k];
+			unsigned char    c  = b[i];
+			int              nc = lzw_enc_find(e, e->code, c);
+
+			if (nc == CODE_NULL)
+			{
+				lzw_enc_miss(e, c, e->ipos + i, flags);
+#if ENC_RUN
+				// a run of the symbol may follow
+				if (i+1 < size[s] && (unsigned char)b[i+1] == c)
+					i = lzw_enc_run(e, b, i, size[s], flags);
+#endif
+			}
+			else
+			{
+				e->code = nc;
+			}
+
+			if (++i < size[s]) {
+				pos[k++] = i;
+			}
+			else {
+				// the stream is done, the last slot takes its place
+				e->ipos += size[s];
+				LZW_STAT(e->stats.in += size[s]);
+				m--;
+				slot[k] = slot[m];
+				pos[k]  = pos[m];
+			}
+		}
+	}
+}
+
+#endif
+
+/******************************************************************************
+**  lzw_encode_batch
+**  --------------------------------------------------------------------------
+**  Encodes the buffers of independent streams like lzw_encode of every
+**  context, the output of every stream is the same. The searches of one
+**  stream depend on each other and wait for the memory, so with
+**  ENC_BATCH > 1 the streams are interleaved to hide the latency
+**  of the table lookups (see lzw_enc_batch_loop). Otherwise, and if
+**  the stream flags of the contexts differ, the streams are encoded
+**  one by one.
+**  
+**  Arguments:
+**      ctx  - LZW encoder contexts, all different;
+**      buf  - input byte buffers;
+**      size - sizes of the buffers;
+**      n    - number of streams;
+**
+**  Return: -
+******************************************************************************/
+void lzw_encode_batch(lzw_enc_t *ctx[], char *buf[], const unsigned size[], unsigned n)
+{
+	const unsigned flags = n ? ctx[0]->flags : 0;
+	unsigned       i;
+
+	for (i = 1; i < n && ENC_BATCH > 1; i++)
+	{
+		if (ctx[i]->flags != flags)
+			break;
+	}
+
+	if (i < n || ENC_BATCH < 2) {
+		for (i = 0; i < n; i++)
+			lzw_encode(ctx[i], buf[i], size[i]);
+		return;
+	}
+
+#if ENC_BATCH > 1
+	switch (flags)
+	{
+	case 0:
+		lzw_enc_batch_loop(ctx, buf, size, n, 0);
+		break;
+	case LZW_FLAG_CLEAR:
+		lzw_enc_batch_loop(ctx, buf, size, n, LZW_FLAG_CLEAR);
+		break;
+	case LZW_DIALECT_Z:
+		lzw_enc_batch_loop(ctx, buf, size, n, LZW_DIALECT_Z);
+		break;
+	case LZW_DIALECT_GIF:
+		lzw_enc_batch_loop(ctx, buf, size, n, LZW_DIALECT_GIF);
+		break;
+	case LZW_DIALECT_TIFF:
+		lzw_enc_batch_loop(ctx, buf, size, n, LZW_DIALECT_TIFF);
+		break;
+	default:
+		lzw_enc_batch_loop(ctx, buf, size, n, flags);
+	}
+#endif
+}
+
+/******************************************************************************
+**  lzw_enc_stats
+**  --------------------------------------------------------------------------
+**  Copies the encoder statistics collected since lzw_enc_init.
+**  The statistics are collected only if the codec is built with LZW_STATS.
+**  
+**  Arguments:
+**      ctx   - LZW encoder context;
+**      stats - output statistics;
+**
+**  Return: 0 or -1 if the statistics are not collected (stats are zeroed).
+******************************************************************************/
+int lzw_enc_stats(const lzw_enc_t *ctx, lzw_enc_stats_t *stats)
+{
+#if LZW_STATS
+	*stats = ctx->stats;
+	return 0;
+#else
+	memset(stats, 0, sizeof(*stats));
+	return -1;
+#endif
+}
+
+/******************************************************************************
+**  lzw_enc_tail
+**  --------------------------------------------------------------------------
+**  Writes the last code, EOI code (LZW_FLAG_EOI) and the rest of
+**  the bit-buffer into the code-buffer, padds the last byte with zero bits.
+**  Nothing is written if it is called again.
+**  
+**  Arguments:
+**      ctx     - LZW encoder context;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_tail(lzw_enc_t *const ctx)
+{
+	if (ctx->end)
+		return;
+#if DEBUG
+	printf("code %x (%d)\n", ctx->code, ctx->codesize);
+#endif
+	// write last code, there is no code if nothing was encoded
+	if (ctx->code != CODE_NULL)
+	{
+		lzw_enc_writecode(ctx, ctx->code, ctx->flags);
+
+		// the decoder adds a string after the last code too
+		if (ctx->flags & LZW_FLAG_EOI)
+			lzw_enc_grow(ctx, ctx->flags);
+	}
+	ctx->code = CODE_NULL;
+
+	if (ctx->flags & LZW_FLAG_EOI)
+		lzw_enc_writecode(ctx, LZW_CODE_EOI, ctx->flags);
+
+	// flush whole bytes in the bit-buffer
+	if (ctx->flags & LZW_FLAG_LSB)
+	{
+		for (; ctx->bb.n >= 8; ctx->bb.n -= 8, ctx->bb.buf >>= 8)
+			ctx->buff[ctx->lzwn++] = (unsigned char)ctx->bb.buf;
+		// the bits above are zero
+		if (ctx->bb.n)
+			ctx->buff[ctx->lzwn++] = (unsigned char)ctx->bb.buf;
+	}
+	else
+	{
+		while (ctx->bb.n >= 8)
+		{
+			ctx->bb.n -= 8;
+			ctx->buff[ctx->lzwn++] = (unsigned char)(ctx->bb.buf >> ctx->bb.n);
+		}
+		// padd the last byte with zero bits
+		if (ctx->bb.n)
+			ctx->buff[ctx->lzwn++] = (unsigned char)(ctx->bb.buf << (8 - ctx->bb.n));
+	}
+	ctx->bb.n   = 0;
+	ctx->bb.buf = 0;
+	ctx->end    = 1;
+}
+
+/******************************************************************************
+**  lzw_enc_end
+**  --------------------------------------------------------------------------
+**  Finish LZW encoding process. As output data is written into output stream
+**  via bit-buffer it can contain unsaved data. This function flushes
+**  bit-buffer and padds last byte with zero bits.
+**  
+**  Arguments:
+**      ctx     - LZW encoder context;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_end(lzw_enc_t *ctx)
+{
+	lzw_enc_tail(ctx);
+	lzw_enc_write(ctx, ctx->buff, ctx->lzwn);
+}
+
+/******************************************************************************
+**  lzw_enc_flush
+**  --------------------------------------------------------------------------
+**  Makes all the input encoded so far decodable without ending the stream
+**  (LZW_FLAG_SYNC): writes the current code and SYNC code, pads the codes
+**  to the byte (to the group with LZW_FLAG_GROUP) and writes the code-buffer
+**  into the output stream. The next input starts a new string, the decoder
+**  keeps the dictionary. The stream without SYNC code is not changed.
+**  The output of lzw_enc_stream cannot be flushed.
+**  
+**  Arguments:
+**      ctx     - LZW encoder context;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_flush(lzw_enc_t *ctx)
+{
+	const unsigned flags = ctx->flags;
+
+	if (!(flags & LZW_FLAG_SYNC) || ctx->end)
+		return;
+
+	if (ctx->code != CODE_NULL)
+	{
+		lzw_enc_writecode(ctx, ctx->code, flags);
+		ctx->opos += ctx->codesize;
+		// the decoder adds a string after the code
+		lzw_enc_grow(ctx, flags);
+	}
+	ctx->code = CODE_NULL;
+#if ENC_RUN
+	ctx->rn   = 0;
+#endif
+#if DEBUG
+	printf("code %x (%d)\n", LZW_CODE_SYNC, ctx->codesize);
+#endif
+
+	lzw_enc_writecode(ctx, LZW_CODE_SYNC, flags);
+	ctx->opos += ctx->codesize;
+
+	if (flags & LZW_FLAG_GROUP)
+		lzw_enc_align(ctx, flags);
+	else
+	{
+		const unsigned pad = (8 - (ctx->bb.n & 7)) & 7;
+
+		lzw_enc_writebits(ctx, 0, pad, flags);
+		ctx->opos += pad;
+	}
+
+	// the bit-buffer has whole bytes now
+	if (flags & LZW_FLAG_LSB)
+	{
+		for (; ctx->bb.n; ctx->bb.n -= 8, ctx->bb.buf >>= 8)
+			ctx->buff[ctx->lzwn++] = (unsigned char)ctx->bb.buf;
+	}
+	else
+	{
+		while (ctx->bb.n)
+		{
+			ctx->bb.n -= 8;
+			ctx->buff[ctx->lzwn++] = (unsigned char)(ctx->bb.buf >> ctx->bb.n);
+		}
+	}
+	ctx->bb.buf = 0;
+
+	lzw_enc_write(ctx, ctx->buff, ctx->lzwn);
+	ctx->lzwn = 0;
+}
+
+/******************************************************************************
+**  lzw_enc_drain
+**  --------------------------------------------------------------------------
+**  Copies the code-buffer bytes which are not written yet to the output
+**  cursor of lzw_enc_stream.
+**  
+**  Arguments:
+**      ctx - LZW encoder context;
+**      io  - input/output cursors;
+**
+**  Return: 0 if all the bytes are copied, 1 if the output is full.
+******************************************************************************/
+static int lzw_enc_drain(lzw_enc_t *const ctx, lzw_io_t *io)
+{
+	unsigned n = ctx->lzwn - ctx->outf < io->avail_out ? ctx->lzwn - ctx->outf : io->avail_out;
+
+	memcpy(io->next_out, ctx->buff + ctx->outf, n);
+	io->next_out  += n;
+	io->avail_out -= n;
+
+	if ((ctx->outf += n) != ctx->lzwn)
+		return 1;
+
+	ctx->lzwn = ctx->outf = 0;
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_enc_stream
+**  --------------------------------------------------------------------------
+**  Encodes bytes from the input cursor into the output cursor.
+**  The input is encoded by portions which fit into the code-buffer,
+**  encoding stops when the input is used up or the output is full.
+**  The rest of the code-buffer is kept in the context and the next call
+**  resumes from the same place. The output stream callback is not used.
+**  The cursors are advanced, call it again with more output space
+**  if avail_out is 0.
+**  
+**  Arguments:
+**      ctx - LZW encoder context;
+**      io  - input/output cursors;
+**      end - the input ends, finish the stream;
+**
+**  Return: LZW_STREAM_END if the stream is finished and all the output
+**          is copied, 0 otherwise.
+******************************************************************************/
+int lzw_enc_stream(lzw_enc_t *ctx, lzw_io_t *io, int end)
+{
+	// a byte takes two codes at most (the code and CLEAR code)
+	const unsigned chunk = (sizeof(ctx->buff) - 8) * 8 / (2 * ctx->maxbits);
+
+	while (!lzw_enc_drain(ctx, io))
+	{
+		unsigned n;
+
+		if (!io->avail_in)
+		{
+			if (!end)
+				return 0;
+
+			// the tail is written only once
+			lzw_enc_tail(ctx);
+
+			return lzw_enc_drain(ctx, io) ? 0 : LZW_STREAM_END;
+		}
+
+		// the portion never fills the code-buffer
+		n = io->avail_in < chunk ? io->avail_in : chunk;
+		lzw_encode(ctx, io->next_in, n);
+		io->next_in  += n;
+		io->avail_in -= n;
+	}
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_enc_bits
+**  --------------------------------------------------------------------------
+**  Selects the smallest dictionary which never overflows for the input
+**  of the given size, up to DICT_BITS. The code stream does not depend on
+**  the dictionary size until the dictionary overflows.
+**  
+**  Arguments:
+**      size - input size;
+**
+**  Return: number of bits in the maximal code
+******************************************************************************/
+static unsigned lzw_enc_bits(unsigned size)
+{
+	unsigned bits = DICT_BITS_MIN;
+
+	// every code except the first one adds a string to the dictionary
+	while (bits < DICT_BITS && (1u << bits) - 256 <= size)
+		bits++;
+
+	return bits;
+}
+
+/******************************************************************************
+**  lzw_compress_bound
+**  --------------------------------------------------------------------------
+**  Returns the maximal size of the lzw_compress output: every input byte
+**  may take a DICT_BITS code.
+**  
+**  Arguments:
+**      size - input size;
+**
+**  Return: output buffer size
+******************************************************************************/
+unsigned lzw_compress_bound(unsigned size)
+{
+	return (unsigned)(((unsigned long long)size * DICT_BITS + 7) / 8);
+}
+
+/******************************************************************************
+**  lzw_compress
+**  --------------------------------------------------------------------------
+**  Encodes the input buffer into the output buffer in one call. The output
+**  is a raw code stream which can be decoded by lzw_decompress or by
+**  the decoder with DICT_BITS dictionary. The stream callbacks are not used.
+**  
+**  Arguments:
+**      dst     - output buffer;
+**      dst_cap - output buffer size, lzw_compress_bound(size) is enough;
+**      src     - input buffer;
+**      size    - input size;
+**
+**  Return: Number of output bytes or error code if the value is negative.
+******************************************************************************/
+int lzw_compress(char *dst, unsigned dst_cap, const char *src, unsigned size)
+{
+	lzw_enc_t *ctx = lzw_enc_create(lzw_enc_bits(size));
+	int       ret;
+
+	if (!ctx)
+		return LZW_ERR_MEMORY;
+
+	lzw_enc_init(ctx, NULL);
+	ctx->dst   = (unsigned char*)dst;
+	ctx->dsize = 0;
+	ctx->dcap  = dst_cap;
+
+	lzw_encode(ctx, (char*)src, size);
+	lzw_enc_end(ctx);
+
+	ret = ctx->dsize > ctx->dcap || ctx->dsize > 0x7FFFFFFF ? LZW_ERR_OUTPUT_BUF : (int)ctx->dsize;
+	lzw_enc_destroy(ctx);
+
+	return ret;
+}
+
+/******************************************************************************
+**  lzw_enc_put32
+**  --------------------------------------------------------------------------
+**  Stores 32-bit value in little-endian byte order.
+**  
+**  Arguments:
+**      p - output bytes;
+**      v - value;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_put32(char *const p, const unsigned v)
+{
+	p[0] = (char)(v);
+	p[1] = (char)(v >> 8);
+	p[2] = (char)(v >> 16);
+	p[3] = (char)(v >> 24);
+}
+
+/******************************************************************************
+**  lzw_enc_put64
+**  --------------------------------------------------------------------------
+**  Stores 64-bit value in little-endian byte order.
+**
+**  Arguments:
+**      p - output bytes;
+**      v - value;
+**
+**  Return: -
+******************************************************************************/
+static void lzw_enc_put64(char *const p, const unsigned long long v)
+{
+	lzw_enc_put32(p,   (unsigned)v);
+	lzw_enc_put32(p+4, (unsigned)(v >> 32));
+}
+
+/******************************************************************************
+**  lzw_enc_frame_hdr
+**  --------------------------------------------------------------------------
+**  Fills the header of the framed stream. The header is followed by
+**  independently encoded blocks (see lzw_enc_block_hdr).
+**  
+**  Arguments:
+**      hdr        - output header buffer;
+**      block_size - maximal number of uncompressed bytes in a block;
+**      max_bits   - number of bits in the maximal code;
+**      flags      - stream flags of the blocks;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_frame_hdr(char hdr[LZW_FRAME_HDR_SIZE], unsigned block_size, unsigned max_bits, unsigned flags)
+{
+	unsigned i;
+
+	for (i = 0; i < 4; i++)
+		hdr[i] = LZW_FRAME_MAGIC[i];
+
+	hdr[4] = LZW_FRAME_VERSION;
+	hdr[5] = (char)max_bits;
+	hdr[6] = (char)flags;
+	hdr[7] = 0;
+	lzw_enc_put32(hdr+8, block_size);
+}
+
+/******************************************************************************
+**  lzw_enc_block_hdr
+**  --------------------------------------------------------------------------
+**  Fills the header of a block in the framed stream. The block data is
+**  a raw code stream produced by lzw_enc_init/lzw_encode/lzw_enc_end.
+**  Block header with zero sizes marks the end of the frame. The block
+**  which does not compress is stored: csize is usize | LZW_BLOCK_STORED
+**  and the uncompressed bytes follow the header.
+**  
+**  Arguments:
+**      hdr   - output header buffer;
+**      csize - size of block codes;
+**      usize - size of uncompressed block data;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_block_hdr(char hdr[LZW_BLOCK_HDR_SIZE], unsigned csize, unsigned usize)
+{
+	lzw_enc_put32(hdr,   csize);
+	lzw_enc_put32(hdr+4, usize);
+}
+
+/******************************************************************************
+**  lzw_enc_z_hdr
+**  --------------------------------------------------------------------------
+**  Fills the header of Unix compress (.Z) file. The header is followed by
+**  LZW_DIALECT_Z code stream.
+**  
+**  Arguments:
+**      hdr      - output header buffer;
+**      max_bits - number of bits in the maximal code, up to LZW_Z_BITS;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_z_hdr(char hdr[LZW_Z_HDR_SIZE], unsigned max_bits)
+{
+	hdr[0] = LZW_Z_MAGIC[0];
+	hdr[1] = LZW_Z_MAGIC[1];
+	hdr[2] = (char)(max_bits | LZW_Z_BLOCK);
+}
+
+/******************************************************************************
+**  lzw_enc_frame_dict
+**  --------------------------------------------------------------------------
+**  Marks the framed stream which blocks are encoded with the primed
+**  dictionary and puts the dictionary ID after the frame header.
+**  The header is filled by lzw_enc_frame_hdr before.
+**  
+**  Arguments:
+**      hdr  - frame header buffer, LZW_FRAME_DICT_SIZE bytes are appended;
+**      dict - primed dictionary (lzw_enc_train);
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_frame_dict(char hdr[LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE], const char *dict)
+{
+	hdr[7] |= LZW_FRAME_DICT;
+	memcpy(hdr + LZW_FRAME_HDR_SIZE, dict + 4, LZW_FRAME_DICT_SIZE);
+}
+
+/******************************************************************************
+**  lzw_enc_index_entry
+**  --------------------------------------------------------------------------
+**  Fills an entry of the block index. The index of the framed stream
+**  (LZW_FRAME_INDEX option) follows the end of the frame: an entry per
+**  block in stream order, the entry of the end of the frame (the offset
+**  of the last block header and the uncompressed size) and the trailer.
+**  
+**  Arguments:
+**      entry   - output entry buffer;
+**      coffset - offset of the block header from the frame header;
+**      uoffset - uncompressed offset of the block;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_index_entry(char entry[LZW_INDEX_ENTRY_SIZE], unsigned long long coffset, unsigned long long uoffset)
+{
+	lzw_enc_put64(entry,   coffset);
+	lzw_enc_put64(entry+8, uoffset);
+}
+
+/******************************************************************************
+**  lzw_enc_index_trailer
+**  --------------------------------------------------------------------------
+**  Fills the trailer of the block index, the last bytes of the file.
+**  
+**  Arguments:
+**      trailer - output trailer buffer;
+**      nblocks - number of blocks in the frame;
+**
+**  Return: -
+******************************************************************************/
+void lzw_enc_index_trailer(char trailer[LZW_INDEX_TRAILER_SIZE], unsigned nblocks)
+{
+	lzw_enc_put32(trailer, nblocks);
+	memcpy(trailer + 4, LZW_INDEX_MAGIC, 4);
+}
+
+/******************************************************************************
+**  lzw_enc_dict_id
+**  --------------------------------------------------------------------------
+**  Computes the ID of the primed dictionary: FNV-1a hash of the bytes
+**  after the ID field.
+**  
+**  Arguments:
+**      dict - primed dictionary;
+**      size - size of the dictionary;
+**
+**  Return: dictionary ID
+******************************************************************************/
+static unsigned lzw_enc_dict_id(const unsigned char *dict, unsigned size)
+{
+	unsigned h = 2166136261u;
+	unsigned i;
+
+	for (i = 8; i < size; i++)
+		h = (h ^ dict[i]) * 16777619u;
+
+	return h;
+}
+
+/******************************************************************************
+**  lzw_enc_dict
+**  --------------------------------------------------------------------------
+**  Sets the primed dictionary trained by lzw_enc_train, the stream flags
+**  are set to the flags of the dictionary. Every stream (lzw_enc_init)
+**  and every dictionary reset starts with the primed strings, the decoder
+**  should use the same dictionary. The dictionary is not copied, it is
+**  shared by the contexts and should be kept while they use it. The cost
+**  of lzw_enc_init is proportional to the number of primed strings.
+**  
+**  Arguments:
+**      ctx  - LZW encoder context;
+**      dict - primed dictionary or NULL to drop it;
+**      size - size of the dictionary;
+**
+**  Return: 0 or LZW_ERR_DICT if the dictionary does not fit the context.
+******************************************************************************/
+int lzw_enc_dict(lzw_enc_t *ctx, const char *dict, unsigned size)
+{
+	const unsigned char *p = (const unsigned char*)dict;
+	unsigned            n, i, base, flags;
+
+	ctx->pdict = NULL;
+	ctx->pn    = 0;
+
+	if (!dict)
+		return 0;
+
+	if (size < LZW_DICT_HDR_SIZE || memcmp(dict, LZW_DICT_MAGIC, 4) || p[8] != ctx->maxbits || (p[9] & ~LZW_FLAGS))
+		return LZW_ERR_DICT;
+
+	flags = p[9] & ~LZW_FLAG_LSB ? p[9] | LZW_FLAG_CLEAR : p[9];
+	base  = LZW_CODE_LAST(flags);
+	n     = lzw_enc_get32(p + 12);
+
+	// the primed strings take up to half of the dictionary
+	if (n > (size - LZW_DICT_HDR_SIZE) / LZW_DICT_STR_SIZE || base + n >= (1u << (ctx->maxbits - 1)))
+		return LZW_ERR_DICT;
+
+	// the prefix is a symbol or one of the previous strings
+	for (i = 0; i < n; i++)
+	{
+		const unsigned code = lzw_enc_get32(p + LZW_DICT_HDR_SIZE + i*LZW_DICT_STR_SIZE);
+
+		if (code > base + i || (code >= 256 && code <= base))
+			return LZW_ERR_DICT;
+	}
+
+	ctx->flags = flags;
+	ctx->pdict = p;
+	ctx->pn    = n;
+
+	return 0;
+}
+
+/******************************************************************************
+**  lzw_enc_train
+**  --------------------------------------------------------------------------
+**  Trains the primed dictionary on the sample data. The sample is encoded
+**  until the dictionary has as many strings as fit into the dictionary
+**  buffer or half of the codes, the strings are the primed dictionary.
+**  The sample should look like the data which will be encoded, for
+**  small messages it may be a concatenation of typical messages.
+**  
+**  Arguments:
+**      dict     - output dictionary buffer;
+**      dict_cap - dictionary buffer capacity, LZW_DICT_HDR_SIZE and
+**                 LZW_DICT_STR_SIZE bytes per string;
+**      max_bits - number of bits in the maximal code of the streams;
+**      flags    - stream flags of the streams;
+**      sample   - sample data;
+**      size     - size of the sample;
+**
+**  Return: Size of the dictionary or error code if the value is negative.
+******************************************************************************/
+int lzw_enc_train(char *dict, unsigned dict_cap, unsigned max_bits, unsigned flags, const char *sample, unsigned size)
+{
+	unsigned char *p = (unsigned char*)dict;
+	lzw_enc_t     *ctx;
+	unsigned      base, limit, n, i;
+
+	if (dict_cap < LZW_DICT_HDR_SIZE)
+		return LZW_ERR_OUTPUT_BUF;
+
+	if (!(ctx = lzw_enc_create(max_bits)))
+		return LZW_ERR_MEMORY;
+
+	lzw_enc_flags(ctx, flags);
+	lzw_enc_init(ctx, NULL);
+	// the codes are counted but not written
+	ctx->dst   = p;
+	ctx->dsize = 0;
+	ctx->dcap  = 0;
+
+	// maximal primed code
+	base  = ctx->max;
+	limit = (1u << (max_bits - 1)) - 1;
+	if (limit < base)
+		limit = base;
+	if (limit - base > (dict_cap - LZW_DICT_HDR_SIZE) / LZW_DICT_STR_SIZE)
+		limit = base + (dict_cap - LZW_DICT_HDR_SIZE) / LZW_DICT_STR_SIZE;
+
+	// short pieces add a few strings over the limit
+	for (i = 0; i < size && ctx->max < limit; i += n)
+	{
+		n = size - i < 64 ? size - i : 64;
+		lzw_encode(ctx, (char*)sample + i, n);
+	}
+
+	n = (ctx->max < limit ? ctx->max : limit) - base;
+
+	// the strings by their codes
+#if ENC_PROBE
+	for (i = 0; i < (2u << max_bits); i++)
+	{
+		const hash_enc_t *hash = &ctx->hash[i];
+		const unsigned   code  = hash->val & 0xFFFFFF;
+
+		if ((hash->val >> 24) == ctx->gen && code > base && code <= base + n)
+		{
+			lzw_enc_put32((char*)p + LZW_DICT_HDR_SIZE + (code-base-1)*LZW_DICT_STR_SIZE, hash->key >> 8);
+			p[LZW_DICT_HDR_SIZE + (code-base-1)*LZW_DICT_STR_SIZE + 4] = (unsigned char)hash->key;
+		}
+	}
+#else
+	for (i = base + 1; i <= base + n; i++)
+	{
+		lzw_enc_put32((char*)p + LZW_DICT_HDR_SIZE + (i-base-1)*LZW_DICT_STR_SIZE, ctx->dict[i].prev);
+		p[LZW_DICT_HDR_SIZE + (i-base-1)*LZW_DICT_STR_SIZE + 4] = ctx->dict[i].ch;
+	}
+#endif
+#if ENC_ROOT
+	// <root>+<symbol> strings are only in the dense table
+	for (i = 0; i < 0x10000; i++)
+	{
+		const root_enc_t *root = &ctx->root[i];
+		const unsigned   code  = (unsigned)root->code;
+
+		if (root->gen == ctx->gen && code > base && code <= base + n)
+		{
+			lzw_enc_put32((char*)p + LZW_DICT_HDR_SIZE + (code-base-1)*LZW_DICT_STR_SIZE, i >> 8);
+			p[LZW_DICT_HDR_SIZE + (code-base-1)*LZW_DICT_STR_SIZE + 4] = (unsigned char)i;
+		}
+	}
+#endif
+
+	memcpy(p, LZW_DICT_MAGIC, 4);
+	p[8]  = (unsigned char)max_bits;
+	p[9]  = (unsigned char)ctx->flags;
+	p[10] = 0;
+	p[11] = 0;
+	lzw_enc_put32((char*)p + 12, n);
+	lzw_enc_put32((char*)p + 4, lzw_enc_dict_id(p, LZW_DICT_HDR_SIZE + n*LZW_DICT_STR_SIZE));
+
+	lzw_enc_destroy(ctx);
+
+	return LZW_DICT_HDR_SIZE + n*LZW_DICT_STR_SIZE;
 }
@@ -21,20 +21,228 @@
 **
 ******************************************************************************/
 #ifndef __LZW_H__
+#define __LZW_H__
 
-// do not set DICT_SIZE > 24bit (32-bit bit-buffer is too short)
-#define DICT_SIZE	(1 << 20)
-#define CODE_NULL	DICT_SIZE
-#define HASH_SIZE	(DICT_SIZE)
+// default number of bits in the maximal code, the dictionary size is
+// selected at runtime by lzw_enc_create/lzw_dec_create in the range
+// DICT_BITS_MIN..DICT_BITS_MAX (codes should fit into int)
+#define DICT_BITS		20
+#define DICT_BITS_MIN	9
+#define DICT_BITS_MAX	30
+#define CODE_NULL		(-1)
+
+// encoder dictionary engine:
+// 0 - hash table of chains embedded into the dictionary nodes,
+// 1 - open addressing hash table of <prefix>+<symbol> keys (linear probing),
+//     the maximal code is limited to 24 bits
+#ifndef ENC_PROBE
+#define ENC_PROBE		0
+#endif
+
+// encoder keeps <root>+<symbol> strings in the dense table of 65536 entries
+#ifndef ENC_ROOT
+#define ENC_ROOT		1
+#endif
+
+// maximal code bits supported by the encoder
+#if ENC_PROBE
+#define ENC_BITS_MAX	24
+#else
+#define ENC_BITS_MAX	DICT_BITS_MAX
+#endif
+
+// hot path statistics counters (lzw_enc_stats/lzw_dec_stats)
+#ifndef LZW_STATS
+#define LZW_STATS		0
+#endif
+
+#if LZW_STATS
+#define LZW_STAT(x)		x
+#else
+#define LZW_STAT(x)
+#endif
+
+// number of codes of the same size read at once by lzw_decode, 0 - one by one
+#ifndef DEC_BATCH
+#define DEC_BATCH		64
+#endif
+
+// number of codes between the prefetched dictionary node and the decoded code
+// in the batch of lzw_decode, 0 - no prefetch
+#ifndef DEC_PREFETCH
+#define DEC_PREFETCH	8
+#endif
+
+// maximal length of the memorized run <c><c>...<c> of the encoder, 0 - no run fast path
+#ifndef ENC_RUN
+#define ENC_RUN			4096
+#endif
+
+// number of streams encoded together by lzw_encode_batch with interleaved
+// table lookups, 0 or 1 - the streams are encoded one by one
+#ifndef ENC_BATCH
+#define ENC_BATCH		0
+#endif
+
+// number of input bytes between compression ratio checks (LZW_FLAG_CLEAR)
+#ifndef ENC_CHECK_GAP
+#define ENC_CHECK_GAP	10000
+#endif
+
+// encoder output buffer size (multiple of 4), the buffer is flushed when it is full
+#ifndef ENC_OBUFF_SIZE
+#define ENC_OBUFF_SIZE	(1 << 16)
+#endif
+
+// decoder output buffer size, the buffer is flushed when it is full
+#ifndef DEC_OBUFF_SIZE
+#define DEC_OBUFF_SIZE	(1 << 16)
+#endif
+
+// decoder output window: strings are copied from the recent output
+// kept in the window, 0 - strings are built by walking the dictionary.
+// The window is limited to 4 bytes per dictionary code.
+#ifndef DEC_WINDOW
+#define DEC_WINDOW		(1 << 22)
+#endif
+
+// contexts write their output by the application defined global lzw_writebuf
+// until lzw_enc_sink/lzw_dec_sink is set, 0 - the codec does not refer to
+// lzw_writebuf, every context which writes into a stream needs a sink
+#ifndef LZW_WRITEBUF
+#define LZW_WRITEBUF	1
+#endif
 
 #define LZW_ERR_DICT_IS_FULL	-1
 #define LZW_ERR_INPUT_BUF		-2
 #define LZW_ERR_WRONG_CODE		-3
+#define LZW_ERR_FRAME			-4
+#define LZW_ERR_OUTPUT_BUF		-5
+#define LZW_ERR_MEMORY			-6
+#define LZW_ERR_DICT			-7
+
+#define LZW_STREAM_END			1	// lzw_enc_stream: all output is written,
+									// lzw_dec_stream: EOI code is decoded
+
+// stream flags (lzw_enc_flags/lzw_dec_flags)
+// LZW_FLAG_CLEAR - code 256 is reserved for CLEAR code, the full dictionary
+//                  is kept until the compression ratio drops, then
+//                  the encoder writes CLEAR code and resets the dictionary
+// LZW_FLAG_LSB   - codes are packed from the least significant bit
+// LZW_FLAG_EOI   - code 257 is reserved for EOI (end of information) code,
+//                  the stream starts with CLEAR code and ends with EOI code,
+//                  the encoder writes CLEAR code before the dictionary is full
+// LZW_FLAG_EARLY - the code size grows one code earlier (TIFF)
+// LZW_FLAG_GROUP - codes are written by groups of 8 codes, the group is
+//                  padded when the code size changes (Unix compress)
+// LZW_FLAG_SYNC  - codes 257 and 258 are reserved, SYNC code 258 written
+//                  by lzw_enc_flush ends the current string, the codes
+//                  are padded to the byte (to the group with LZW_FLAG_GROUP),
+//                  the dictionary is kept
+// The flags except LZW_FLAG_LSB imply LZW_FLAG_CLEAR.
+#define LZW_FLAG_CLEAR			0x01
+#define LZW_FLAG_LSB			0x02
+#define LZW_FLAG_EOI			0x04
+#define LZW_FLAG_EARLY			0x08
+#define LZW_FLAG_GROUP			0x10
+#define LZW_FLAG_SYNC			0x20
+#define LZW_FLAGS				(LZW_FLAG_CLEAR | LZW_FLAG_LSB | LZW_FLAG_EOI | LZW_FLAG_EARLY | LZW_FLAG_GROUP | LZW_FLAG_SYNC)	// all known flags
+
+// code streams of other LZW implementations, 8-bit symbols
+#define LZW_DIALECT_Z			(LZW_FLAG_CLEAR | LZW_FLAG_LSB | LZW_FLAG_GROUP)	// Unix compress, block mode
+#define LZW_DIALECT_GIF			(LZW_FLAG_CLEAR | LZW_FLAG_LSB | LZW_FLAG_EOI)		// GIF, LZW minimum code size 8
+#define LZW_DIALECT_TIFF		(LZW_FLAG_CLEAR | LZW_FLAG_EOI | LZW_FLAG_EARLY)	// TIFF compression 5
+
+#define LZW_CODE_CLEAR			256
+#define LZW_CODE_EOI			257
+#define LZW_CODE_SYNC			258
+
+// the last reserved code of the stream flags, the strings get the next codes
+#define LZW_CODE_LAST(flags)	((flags) & LZW_FLAG_SYNC ? LZW_CODE_SYNC : (flags) & LZW_FLAG_EOI ? LZW_CODE_EOI : (flags) & LZW_FLAG_CLEAR ? LZW_CODE_CLEAR : 255)
+
+// Unix compress (.Z) file header: magic[2], max bits | 0x80 (block mode)
+#define LZW_Z_MAGIC				"\x1f\x9d"
+#define LZW_Z_HDR_SIZE			3
+#define LZW_Z_BITS				16	// maximal code size of compress
+#define LZW_Z_BITS_MIN			10	// compress widens the codes of full 9-bit dictionary
+#define LZW_Z_BLOCK				0x80
+
+// framed stream format:
+//   <frame header> [dictionary ID[4]] <block header><block codes> ... <block header = 0,0>
+//   [block index]
+// frame header:  magic[4], version, dict bits, flags, options, block size[4]
+// block header:  compressed size[4], uncompressed size[4]
+//                the stored block (LZW_BLOCK_STORED in the compressed size)
+//                holds the uncompressed bytes instead of the codes
+// All multibyte fields are little-endian. Every block is encoded with
+// a fresh (or primed) dictionary so blocks can be processed independently.
+// The second magic byte 0xFF cannot start a raw stream: it would make
+// the second 9-bit code greater than 256.
+#define LZW_FRAME_MAGIC			"\x89\xffLZ"
+#define LZW_FRAME_VERSION		1
+#define LZW_FRAME_HDR_SIZE		12
+#define LZW_BLOCK_HDR_SIZE		8
+#define LZW_BLOCK_SIZE			(1 << 20)	// default block size
+#define LZW_FRAME_DICT			0x01		// frame option: the blocks use the primed dictionary,
+											// its ID follows the frame header
+#define LZW_FRAME_DICT_SIZE		4
+#define LZW_FRAME_INDEX			0x02		// frame option: the block index follows the frame
+#define LZW_FRAME_STORED		0x04		// frame option: the blocks can be stored
+#define LZW_BLOCK_STORED		0x80000000u	// compressed size flag of the stored block
+
+// block index: <entry> per block, <entry> of the end of the frame, <trailer>
+// entry:   offset of the block header from the frame header[8],
+//          uncompressed offset of the block[8]
+// trailer: number of blocks[4], magic[4]
+// The trailer ends the file, the index is found from its end.
+#define LZW_INDEX_MAGIC			"\x89\xffLI"
+#define LZW_INDEX_ENTRY_SIZE	16
+#define LZW_INDEX_TRAILER_SIZE	8
+
+// primed dictionary format (lzw_enc_train):
+//   magic[4], ID[4], dict bits, flags, reserved[2], number of strings[4],
+//   strings: prefix code[4], symbol
+// The strings get the codes following the reserved codes in order,
+// the prefix code of a string is less than its code. All multibyte fields
+// are little-endian, the ID is FNV-1a hash of the bytes after the ID.
+#define LZW_DICT_MAGIC			"\x89\xffLD"
+#define LZW_DICT_HDR_SIZE		16
+#define LZW_DICT_STR_SIZE		5
+
+// conversion of 32/64-bit words to the code stream byte order (MSB first)
+// and to the LSB first byte order (LZW_FLAG_LSB)
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#define LZW_BE32(x)	_byteswap_ulong(x)
+#define LZW_BE64(x)	_byteswap_uint64(x)
+#define LZW_LE32(x)	(x)
+#define LZW_LE64(x)	(x)
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LZW_BE32(x)	__builtin_bswap32(x)
+#define LZW_BE64(x)	__builtin_bswap64(x)
+#define LZW_LE32(x)	(x)
+#define LZW_LE64(x)	(x)
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LZW_BE32(x)	(x)
+#define LZW_BE64(x)	(x)
+#define LZW_LE32(x)	__builtin_bswap32(x)
+#define LZW_LE64(x)	__builtin_bswap64(x)
+#endif
+
+// cache prefetch hint, the address is not dereferenced
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#define LZW_PREFETCH(p)	_mm_prefetch((const char*)(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define LZW_PREFETCH(p)	__builtin_prefetch(p)
+#else
+#define LZW_PREFETCH(p)
+#endif
 
 // bit-buffer
 typedef struct _bitbuffer
 {
-	unsigned long buf;		// bits
+	unsigned long long buf;	// bits
 	unsigned n;				// number of bits
 }
 bitbuffer_t;
@@ -48,26 +256,128 @@ typedef struct _node_enc
 }
 node_enc_t;
 
+#if ENC_PROBE
+// LZW encoder hash table entry, represents a string
+typedef struct _hash_enc
+{
+	unsigned      key;		// prefix code << 8 | last symbol
+	unsigned      val;		// dictionary generation << 24 | code
+}
+hash_enc_t;
+#else
+// LZW encoder hash table entry
+typedef struct _hash_enc
+{
+	int           code;		// the first code in the chain
+	unsigned      gen;		// dictionary generation of the entry
+}
+hash_enc_t;
+#endif
+
+// LZW encoder dense table entry, represents <root>+<symbol> string
+typedef struct _root_enc
+{
+	int           code;		// string code
+	unsigned      gen;		// dictionary generation of the entry
+}
+root_enc_t;
+
 // LZW decoder node, represents a string
 typedef struct _node_dec
 {
 	int           prev;		// prefix code
 	unsigned char ch;		// last symbol
+#if DEC_WINDOW
+	unsigned      len;		// string length
+	unsigned      pos;		// string position since the dictionary reset
+#endif
 }
 node_dec_t;
 
+// output callback of the context, the buffer is valid until it returns
+typedef void (*lzw_write_t)(void *stream, char *buf, unsigned size);
+
+// input/output cursors of lzw_enc_stream/lzw_dec_stream
+typedef struct _lzw_io
+{
+	char          *next_in;		// next input byte
+	unsigned      avail_in;		// number of input bytes
+	char          *next_out;	// next output byte
+	unsigned      avail_out;	// free space in the output
+}
+lzw_io_t;
+
+// LZW encoder statistics
+typedef struct _lzw_enc_stats
+{
+	unsigned long long in;			// number of input bytes
+	unsigned long long bits;		// number of output bits
+	unsigned long long codes[DICT_BITS_MAX+1];	// written codes by code size
+	unsigned long long resets;		// dictionary resets (with CLEAR code)
+	unsigned long long clears;		// CLEAR codes
+	unsigned long long roots;		// searches in the dense table (ENC_ROOT)
+	unsigned long long finds;		// searches in the hash table
+	unsigned long long probes;		// chain nodes or table entries visited by the searches
+	unsigned long long probe_max;	// the longest search
+}
+lzw_enc_stats_t;
+
+// LZW decoder statistics
+typedef struct _lzw_dec_stats
+{
+	unsigned long long in;			// number of input bytes
+	unsigned long long out;			// number of output bytes
+	unsigned long long codes[DICT_BITS_MAX+1];	// read codes by code size
+	unsigned long long resets;		// dictionary resets (with CLEAR code)
+	unsigned long long clears;		// CLEAR codes
+	unsigned long long kwkwk;		// unknown codes <code>+<first symbol of code>
+	unsigned long long strings;		// number of written strings
+	unsigned long long walks;		// walks of the dictionary by lzw_dec_getstr
+	unsigned long long walk_bytes;	// number of bytes built by the walks
+}
+lzw_dec_stats_t;
+
 // LZW encoder context
 typedef struct _lzw_enc
 {
 	int           code;				// current code
 	unsigned      max;				// maximal code
 	unsigned      codesize;			// number of bits in code
+	unsigned      maxbits;			// number of bits in the maximal code
 	bitbuffer_t   bb;				// bit-buffer struct
 	void          *stream;			// pointer to the stream object
+	lzw_write_t   write;			// output callback of the stream
 	unsigned      lzwn;				// output code-buffer byte counter
-	node_enc_t    dict[DICT_SIZE];	// code dictionary
-	int           hash[HASH_SIZE];	// hast table
-	unsigned char buff[256];		// output code-buffer
+	unsigned      outf;				// code-buffer bytes copied by lzw_enc_stream
+	unsigned      gen;				// dictionary generation
+	unsigned      flags;			// stream flags
+	unsigned long long ipos;		// number of input bytes
+	unsigned long long opos;		// number of output bits
+	unsigned long long ibase;		// ipos of the dictionary reset
+	unsigned long long obase;		// opos of the dictionary reset
+	unsigned long long check;		// ipos of the next ratio check
+	unsigned long long ratio;		// last compression ratio since the reset
+	unsigned long long gbase;		// opos of the code group (LZW_FLAG_GROUP)
+	int           end;				// the tail is written
+	const unsigned char *pdict;		// primed dictionary or NULL
+	unsigned      pn;				// number of primed strings
+#if ENC_RUN
+	unsigned      rch;				// symbol of the memorized run
+	unsigned      rn;				// number of memorized run codes, 0 - none
+	int           run[ENC_RUN];		// run[k] - code of the string of k+1 rch symbols
+#endif
+	unsigned char *dst;				// output buffer of lzw_compress or NULL
+	unsigned long long dsize;		// number of bytes written into dst
+	unsigned      dcap;				// dst capacity
+	node_enc_t    *dict;			// code dictionary, 1 << maxbits nodes (no ENC_PROBE)
+	hash_enc_t    *hash;			// hash table, 1 << maxbits entries (x2 for ENC_PROBE)
+#if ENC_ROOT
+	root_enc_t    *root;			// dense table, 256*256 entries
+#endif
+#if LZW_STATS
+	lzw_enc_stats_t stats;			// statistics since lzw_enc_init
+#endif
+	unsigned char buff[ENC_OBUFF_SIZE];	// output code-buffer
 }
 lzw_enc_t;
 
@@ -77,26 +387,104 @@ typedef struct _lzw_dec
 	int           code;				// current code
 	unsigned      max;				// maximal code
 	unsigned      codesize;			// number of bits in code
+	unsigned      maxbits;			// number of bits in the maximal code
+	unsigned      flags;			// stream flags
 	bitbuffer_t   bb;				// bit-buffer struct
 	void          *stream;			// pointer to the stream object
+	lzw_write_t   write;			// output callback of the stream
 	unsigned      lzwn;				// input code-buffer byte counter
 	unsigned      lzwm;				// input code-buffer size
 	unsigned char *inbuff;		    // input code-buffer
-	node_dec_t    dict[DICT_SIZE];	// code dictionary
+	unsigned      outn;				// output buffer byte counter
+	unsigned      osize;			// output buffer size
+	unsigned      outf;				// number of flushed output buffer bytes
+	lzw_io_t      *io;				// output cursor of lzw_dec_stream or NULL
+	unsigned char *pstr;			// the rest of the long string for lzw_dec_stream
+	unsigned      plen;				// number of bytes in pstr
+	unsigned      gbits;			// bits read since the code group start (LZW_FLAG_GROUP)
+	unsigned      skip;				// padding bits of the code group to skip
+	int           end;				// EOI code is decoded (LZW_FLAG_EOI)
+	unsigned      pmax;				// maximal primed code, 0 - no primed dictionary
+	unsigned      psize;			// code size after the primed strings
+	unsigned      pid;				// ID of the primed dictionary
+#if DEC_WINDOW
+	unsigned      wsize;			// output window size
+	unsigned long long wpos;		// output stream position of obuff[0]
+	unsigned long long gpos;		// output stream position of the dictionary reset
+	unsigned      ppos;				// string position of the current code
+	unsigned      npos;				// string position of the new code
+#endif
+	node_dec_t    *dict;			// code dictionary, 1 << maxbits nodes
 	unsigned char c;				// first char of the code
-	unsigned char buff[DICT_SIZE];	// output string buffer
+	unsigned char *buff;			// output string buffer, 1 << maxbits bytes
+	unsigned char *obuff;			// output buffer (window), osize bytes
+	unsigned char *dst;				// output buffer of lzw_decompress or NULL
+	unsigned long long dsize;		// number of bytes written into dst
+	unsigned      dcap;				// dst capacity
+#if LZW_STATS
+	lzw_dec_stats_t stats;			// statistics since lzw_dec_init
+#endif
 }
 lzw_dec_t;
 
-void lzw_enc_init(lzw_enc_t *ctx, void *stream);
-int  lzw_encode  (lzw_enc_t *ctx, char buf[], unsigned size);
-void lzw_enc_end (lzw_enc_t *ctx);
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+lzw_enc_t *lzw_enc_create (unsigned max_bits);
+void      lzw_enc_destroy(lzw_enc_t *ctx);
+void      lzw_enc_flags  (lzw_enc_t *ctx, unsigned flags);
+void      lzw_enc_sink   (lzw_enc_t *ctx, lzw_write_t write);
+void      lzw_enc_init   (lzw_enc_t *ctx, void *stream);
+int       lzw_encode     (lzw_enc_t *ctx, char buf[], unsigned size);
+void      lzw_encode_batch(lzw_enc_t *ctx[], char *buf[], const unsigned size[], unsigned n);
+void      lzw_enc_end    (lzw_enc_t *ctx);
+void      lzw_enc_flush  (lzw_enc_t *ctx);
+int       lzw_enc_stream (lzw_enc_t *ctx, lzw_io_t *io, int end);
+int       lzw_enc_stats  (const lzw_enc_t *ctx, lzw_enc_stats_t *stats);
+int       lzw_enc_dict   (lzw_enc_t *ctx, const char *dict, unsigned size);
 
-void lzw_dec_init(lzw_dec_t *ctx, void *stream);
-int  lzw_decode  (lzw_dec_t *ctx, char buf[], unsigned size);
+lzw_dec_t *lzw_dec_create (unsigned max_bits);
+void      lzw_dec_destroy(lzw_dec_t *ctx);
+void      lzw_dec_flags  (lzw_dec_t *ctx, unsigned flags);
+void      lzw_dec_sink   (lzw_dec_t *ctx, lzw_write_t write);
+void      lzw_dec_init   (lzw_dec_t *ctx, void *stream);
+int       lzw_decode     (lzw_dec_t *ctx, char buf[], unsigned size);
+int       lzw_dec_stream (lzw_dec_t *ctx, lzw_io_t *io);
+int       lzw_dec_stats  (const lzw_dec_t *ctx, lzw_dec_stats_t *stats);
+int       lzw_dec_dict   (lzw_dec_t *ctx, const char *dict, unsigned size);
 
-// Application defined stream callbacks
+// primed dictionary trained on the sample data
+int       lzw_enc_train (char *dict, unsigned dict_cap, unsigned max_bits, unsigned flags, const char *sample, unsigned size);
+
+// one-shot memory to memory coding, the raw stream with DICT_BITS codes
+unsigned  lzw_compress_bound(unsigned size);
+int       lzw_compress  (char *dst, unsigned dst_cap, const char *src, unsigned size);
+int       lzw_decompress(char *dst, unsigned dst_cap, const char *src, unsigned size);
+
+void lzw_enc_frame_hdr(char hdr[LZW_FRAME_HDR_SIZE], unsigned block_size, unsigned max_bits, unsigned flags);
+void lzw_enc_block_hdr(char hdr[LZW_BLOCK_HDR_SIZE], unsigned csize, unsigned usize);
+void lzw_enc_z_hdr    (char hdr[LZW_Z_HDR_SIZE], unsigned max_bits);
+void lzw_enc_frame_dict(char hdr[LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE], const char *dict);
+int  lzw_dec_frame_hdr(const char hdr[LZW_FRAME_HDR_SIZE], unsigned *block_size, unsigned *max_bits, unsigned *flags);
+int  lzw_dec_block_hdr(const char hdr[LZW_BLOCK_HDR_SIZE], unsigned *csize, unsigned *usize);
+int  lzw_dec_z_hdr    (const char hdr[LZW_Z_HDR_SIZE], unsigned *max_bits, unsigned *flags);
+int  lzw_dec_frame_dict(const char hdr[LZW_FRAME_HDR_SIZE + LZW_FRAME_DICT_SIZE], const char *dict);
+
+// block index of the framed stream and random access to its bytes
+void lzw_enc_index_entry  (char entry[LZW_INDEX_ENTRY_SIZE], unsigned long long coffset, unsigned long long uoffset);
+void lzw_enc_index_trailer(char trailer[LZW_INDEX_TRAILER_SIZE], unsigned nblocks);
+const char *lzw_dec_index (const char *frame, unsigned long long size, unsigned *nblocks);
+void lzw_dec_index_entry  (const char entry[LZW_INDEX_ENTRY_SIZE], unsigned long long *coffset, unsigned long long *uoffset);
+int  lzw_dec_range        (lzw_dec_t *ctx, void *stream, const char *frame, unsigned long long size, unsigned long long offset, unsigned long long len);
+
+// Application defined stream callbacks, the default sink of the contexts
+// (LZW_WRITEBUF), lzw_compress/lzw_decompress do not use them
 void     lzw_writebuf(void *stream, char *buf, unsigned size);
 unsigned lzw_readbuf (void *stream, char *buf, unsigned size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif //__LZW_H__
@@ -0,0 +1,280 @@
+/******************************************************************************
+**  LZW codec for C++
+**  --------------------------------------------------------------------------
+**
+**  Header-only C++ layer over the LZW codec (lzw-enc.c, lzw-dec.c):
+**  move-only contexts sized by the template parameter and the output sink
+**  of any callable type. The sink is called with the whole code-buffer or
+**  output buffer, not per code, so the contexts of different sinks share
+**  the same compiled codec.
+**
+**  Author: V.Antonenko
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 2 of the License,
+** or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+** See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along
+** with this program; if not, write to the Free Software Foundation, Inc.
+**
+******************************************************************************/
+#ifndef __LZW_HPP__
+#define __LZW_HPP__
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 202002L
+#include <span>
+#define LZW_SPAN	1
+#endif
+#include "lzw.h"
+
+namespace lzw {
+
+// the longest buffer passed to lzw_encode/lzw_decode at once
+const std::size_t CHUNK = std::size_t(1) << 30;
+
+// sink appending the output to the vector
+class VectorSink
+{
+public:
+	explicit VectorSink(std::vector<char> &v) : v_(&v) {}
+
+	void operator()(const char *buf, std::size_t size) { v_->insert(v_->end(), buf, buf + size); }
+
+private:
+	std::vector<char> *v_;
+};
+
+// sink writing the output into the fixed buffer, the bytes which do not fit
+// are counted but not written
+class BufferSink
+{
+public:
+	BufferSink(char *buf, std::size_t cap) : buf_(buf), cap_(cap), size_(0) {}
+
+	void operator()(const char *buf, std::size_t size)
+	{
+		if (size_ + size <= cap_)
+			std::memcpy(buf_ + size_, buf, size);
+		size_ += size;
+	}
+
+	std::size_t size() const { return size_; }		// number of output bytes
+	bool overflow() const { return size_ > cap_; }
+
+private:
+	char        *buf_;
+	std::size_t cap_;
+	std::size_t size_;
+};
+
+// LZW encoder of MaxBits codes writing into Sink (void(const char*, size_t))
+template <unsigned MaxBits, class Sink>
+class Encoder
+{
+public:
+	static_assert(MaxBits >= DICT_BITS_MIN && MaxBits <= ENC_BITS_MAX, "MaxBits is out of DICT_BITS_MIN..ENC_BITS_MAX");
+
+	static const unsigned max_bits = MaxBits;
+	static const std::size_t dict_size = std::size_t(1) << MaxBits;	// number of codes
+
+	// throws std::bad_alloc if the context cannot be allocated
+	explicit Encoder(Sink sink = Sink(), unsigned flags = 0) : ctx_(lzw_enc_create(MaxBits)), sink_(std::move(sink))
+	{
+		if (!ctx_)
+			throw std::bad_alloc();
+		lzw_enc_flags(ctx_, flags);
+		lzw_enc_sink(ctx_, write);
+		ctx_->stream = this;
+	}
+
+	~Encoder() { if (ctx_) lzw_enc_destroy(ctx_); }
+
+	Encoder(Encoder &&e) noexcept : ctx_(e.ctx_), sink_(std::move(e.sink_))
+	{
+		e.ctx_ = nullptr;
+		if (ctx_)
+			ctx_->stream = this;
+	}
+
+	Encoder &operator=(Encoder &&e) noexcept
+	{
+		if (this != &e) {
+			if (ctx_)
+				lzw_enc_destroy(ctx_);
+			ctx_   = e.ctx_;
+			sink_  = std::move(e.sink_);
+			e.ctx_ = nullptr;
+			if (ctx_)
+				ctx_->stream = this;
+		}
+		return *this;
+	}
+
+	Encoder(const Encoder &) = delete;
+	Encoder &operator=(const Encoder &) = delete;
+
+	// the flags and the primed dictionary take effect at the next init
+	void flags(unsigned flags) { lzw_enc_flags(ctx_, flags); }
+	int  dict(const char *dict, unsigned size) { return lzw_enc_dict(ctx_, dict, size); }
+
+	void init() { lzw_enc_init(ctx_, this); }
+
+	void encode(const char *buf, std::size_t size)
+	{
+		while (size)
+		{
+			const unsigned n = (unsigned)(size < CHUNK ? size : CHUNK);
+
+			lzw_encode(ctx_, const_cast<char*>(buf), n);
+			buf  += n;
+			size -= n;
+		}
+	}
+
+	void end() { lzw_enc_end(ctx_); }
+
+	// the input so far becomes decodable, the stream goes on (LZW_FLAG_SYNC)
+	void flush() { lzw_enc_flush(ctx_); }
+
+	// the whole stream: init, encode, end
+	void encode_all(const char *buf, std::size_t size)
+	{
+		init();
+		encode(buf, size);
+		end();
+	}
+
+#if LZW_SPAN
+	void encode(std::span<const char> buf) { encode(buf.data(), buf.size()); }
+	void encode_all(std::span<const char> buf) { encode_all(buf.data(), buf.size()); }
+#endif
+
+	Sink &sink() { return sink_; }
+	lzw_enc_t *get() { return ctx_; }
+
+private:
+	static void write(void *stream, char *buf, unsigned size)
+	{
+		static_cast<Encoder*>(stream)->sink_(buf, size);
+	}
+
+	lzw_enc_t *ctx_;
+	Sink      sink_;
+};
+
+// LZW decoder of MaxBits codes writing into Sink (void(const char*, size_t))
+template <unsigned MaxBits, class Sink>
+class Decoder
+{
+public:
+	static_assert(MaxBits >= DICT_BITS_MIN && MaxBits <= DICT_BITS_MAX, "MaxBits is out of DICT_BITS_MIN..DICT_BITS_MAX");
+
+	static const unsigned max_bits = MaxBits;
+	static const std::size_t dict_size = std::size_t(1) << MaxBits;	// number of codes
+
+	// throws std::bad_alloc if the context cannot be allocated
+	explicit Decoder(Sink sink = Sink(), unsigned flags = 0) : ctx_(lzw_dec_create(MaxBits)), sink_(std::move(sink))
+	{
+		if (!ctx_)
+			throw std::bad_alloc();
+		lzw_dec_flags(ctx_, flags);
+		lzw_dec_sink(ctx_, write);
+		ctx_->stream = this;
+	}
+
+	~Decoder() { if (ctx_) lzw_dec_destroy(ctx_); }
+
+	Decoder(Decoder &&d) noexcept : ctx_(d.ctx_), sink_(std::move(d.sink_))
+	{
+		d.ctx_ = nullptr;
+		if (ctx_)
+			ctx_->stream = this;
+	}
+
+	Decoder &operator=(Decoder &&d) noexcept
+	{
+		if (this != &d) {
+			if (ctx_)
+				lzw_dec_destroy(ctx_);
+			ctx_   = d.ctx_;
+			sink_  = std::move(d.sink_);
+			d.ctx_ = nullptr;
+			if (ctx_)
+				ctx_->stream = this;
+		}
+		return *this;
+	}
+
+	Decoder(const Decoder &) = delete;
+	Decoder &operator=(const Decoder &) = delete;
+
+	// the flags and the primed dictionary take effect at the next init
+	void flags(unsigned flags) { lzw_dec_flags(ctx_, flags); }
+	int  dict(const char *dict, unsigned size) { return lzw_dec_dict(ctx_, dict, size); }
+
+	void init() { lzw_dec_init(ctx_, this); }
+
+	// returns the number of decoded input bytes (less after EOI code)
+	// or LZW_ERR_* error code if the value is negative
+	long long decode(const char *buf, std::size_t size)
+	{
+		long long done = 0;
+
+		while (size)
+		{
+			const unsigned n   = (unsigned)(size < CHUNK ? size : CHUNK);
+			const int      ret = lzw_decode(ctx_, const_cast<char*>(buf), n);
+
+			if (ret < 0)
+				return ret;
+
+			done += ret;
+			if ((unsigned)ret < n)
+				break;
+
+			buf  += n;
+			size -= n;
+		}
+
+		return done;
+	}
+
+	// the whole stream: init, decode
+	long long decode_all(const char *buf, std::size_t size)
+	{
+		init();
+		return decode(buf, size);
+	}
+
+#if LZW_SPAN
+	long long decode(std::span<const char> buf) { return decode(buf.data(), buf.size()); }
+	long long decode_all(std::span<const char> buf) { return decode_all(buf.data(), buf.size()); }
+#endif
+
+	Sink &sink() { return sink_; }
+	lzw_dec_t *get() { return ctx_; }
+
+private:
+	static void write(void *stream, char *buf, unsigned size)
+	{
+		static_cast<Decoder*>(stream)->sink_(buf, size);
+	}
+
+	lzw_dec_t *ctx_;
+	Sink      sink_;
+};
+
+} // namespace lzw
+
+#endif //__LZW_HPP__
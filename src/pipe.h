@@ -0,0 +1,222 @@
+/******************************************************************************
+**  I/O pipes
+**  --------------------------------------------------------------------------
+**
+**  Ring of chunks between the codec thread of the encoder/decoder tools
+**  and an I/O thread: the input pipe reads the next chunks of the input
+**  file ahead, the output pipe writes the filled chunks. The codec thread
+**  only copies the bytes, so the time of a stream is the larger of its
+**  compute and I/O time instead of their sum.
+**
+**  Author: V.Antonenko
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 2 of the License,
+** or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+** See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along
+** with this program; if not, write to the Free Software Foundation, Inc.
+**
+******************************************************************************/
+#ifndef __PIPE_H__
+#define __PIPE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "thread.h"
+
+// number of chunks in the ring and chunk size
+#define PIPE_CHUNKS	4
+#define PIPE_CHUNK	(1u << 20)
+
+// the producer queues chunks at the tail, the consumer takes them at the head
+typedef struct _pipe
+{
+	mutex_t       lock;
+	cond_t        full;		// signaled when a chunk is queued
+	cond_t        empty;	// signaled when a chunk is released
+	char          *buf;		// ring of chunks
+	unsigned      len[PIPE_CHUNKS];	// number of bytes in the queued chunks
+	unsigned      head;		// sequence number of the oldest queued chunk
+	unsigned      tail;		// sequence number of the next chunk to queue
+	unsigned      fill;		// output: bytes in the chunk being filled, input: the head chunk is taken
+	int           quit;		// output: no more chunks, input: the file is closed
+	FILE          *file;
+	thread_t      thread;	// reader or writer thread
+}
+pipe_t;
+
+// writer thread: writes the queued chunks in order
+static THREAD_PROC(pipe_writer, arg)
+{
+	pipe_t *p = (pipe_t*)arg;
+
+	mutex_lock(&p->lock);
+
+	for (;;)
+	{
+		unsigned slot;
+
+		while (p->head == p->tail && !p->quit)
+			cond_wait(&p->full, &p->lock);
+
+		if (p->head == p->tail)
+			break;
+
+		slot = p->head % PIPE_CHUNKS;
+		mutex_unlock(&p->lock);
+
+		fwrite(p->buf + slot * PIPE_CHUNK, p->len[slot], 1, p->file);
+
+		mutex_lock(&p->lock);
+		p->head++;
+		cond_signal(&p->empty);
+	}
+
+	mutex_unlock(&p->lock);
+
+	THREAD_RETURN;
+}
+
+// reader thread: keeps the ring full, the empty chunk marks the end of file
+static THREAD_PROC(pipe_reader, arg)
+{
+	pipe_t   *p = (pipe_t*)arg;
+	unsigned len;
+
+	mutex_lock(&p->lock);
+
+	do
+	{
+		unsigned slot;
+
+		while (p->tail - p->head == PIPE_CHUNKS && !p->quit)
+			cond_wait(&p->empty, &p->lock);
+
+		if (p->quit)
+			break;
+
+		slot = p->tail % PIPE_CHUNKS;
+		mutex_unlock(&p->lock);
+
+		len = fread(p->buf + slot * PIPE_CHUNK, 1, PIPE_CHUNK, p->file);
+
+		mutex_lock(&p->lock);
+		p->len[slot] = len;
+		p->tail++;
+		cond_signal(&p->full);
+	}
+	while (len);
+
+	mutex_unlock(&p->lock);
+
+	THREAD_RETURN;
+}
+
+// starts the reader (input) or the writer thread, 0 or -1 on error;
+// the input is read from the current position of the file
+__inline static int pipe_open(pipe_t *p, FILE *file, int input)
+{
+	memset(p, 0, sizeof(*p));
+	p->file = file;
+
+	if (!(p->buf = (char*)malloc(PIPE_CHUNKS * PIPE_CHUNK)))
+		return -1;
+
+	mutex_init(&p->lock);
+	cond_init(&p->full);
+	cond_init(&p->empty);
+
+	if (thread_create(&p->thread, input ? pipe_reader : pipe_writer, p))
+	{
+		cond_destroy(&p->empty);
+		cond_destroy(&p->full);
+		mutex_destroy(&p->lock);
+		free(p->buf);
+		return -1;
+	}
+
+	return 0;
+}
+
+// output: queues the chunk being filled and waits for a free chunk
+__inline static void pipe_push(pipe_t *p)
+{
+	mutex_lock(&p->lock);
+	p->len[p->tail++ % PIPE_CHUNKS] = p->fill;
+	cond_signal(&p->full);
+
+	while (p->tail - p->head == PIPE_CHUNKS)
+		cond_wait(&p->empty, &p->lock);
+	mutex_unlock(&p->lock);
+
+	p->fill = 0;
+}
+
+// output: copies the bytes into the ring
+__inline static void pipe_write(pipe_t *p, const char *buf, unsigned size)
+{
+	while (size)
+	{
+		unsigned n = PIPE_CHUNK - p->fill < size ? PIPE_CHUNK - p->fill : size;
+
+		memcpy(p->buf + (p->tail % PIPE_CHUNKS) * PIPE_CHUNK + p->fill, buf, n);
+		p->fill += n;
+		buf     += n;
+		size    -= n;
+
+		if (p->fill == PIPE_CHUNK)
+			pipe_push(p);
+	}
+}
+
+// input: releases the previous chunk and waits for the next one,
+// returns its size, 0 at the end of file
+__inline static unsigned pipe_read(pipe_t *p, char **buf)
+{
+	unsigned slot;
+
+	mutex_lock(&p->lock);
+	if (p->fill) {
+		p->head++;
+		cond_signal(&p->empty);
+	}
+
+	while (p->head == p->tail)
+		cond_wait(&p->full, &p->lock);
+	mutex_unlock(&p->lock);
+
+	slot    = p->head % PIPE_CHUNKS;
+	p->fill = 1;
+	*buf    = p->buf + slot * PIPE_CHUNK;
+
+	return p->len[slot];
+}
+
+// output: writes the rest of the chunks, input: drops the chunks read ahead;
+// stops the thread
+__inline static void pipe_close(pipe_t *p, int input)
+{
+	if (!input && p->fill)
+		pipe_push(p);
+
+	mutex_lock(&p->lock);
+	p->quit = 1;
+	cond_signal(input ? &p->empty : &p->full);
+	mutex_unlock(&p->lock);
+
+	thread_join(p->thread);
+	cond_destroy(&p->empty);
+	cond_destroy(&p->full);
+	mutex_destroy(&p->lock);
+	free(p->buf);
+}
+
+#endif //__PIPE_H__
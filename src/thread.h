@@ -0,0 +1,111 @@
+/******************************************************************************
+**  Threads
+**  --------------------------------------------------------------------------
+**
+**  Minimal portable threading primitives for the encoder/decoder tools.
+**  The LZW codec itself does not use them.
+**
+**  Author: V.Antonenko
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of the GNU General Public License as published by the
+** Free Software Foundation; either version 2 of the License,
+** or (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+** See the GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License along
+** with this program; if not, write to the Free Software Foundation, Inc.
+**
+******************************************************************************/
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+typedef HANDLE             thread_t;
+typedef CRITICAL_SECTION   mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+
+#define THREAD_PROC(name, arg)	DWORD WINAPI name(LPVOID arg)
+#define THREAD_RETURN			return 0
+
+__inline static int thread_create(thread_t *t, LPTHREAD_START_ROUTINE proc, void *arg)
+{
+	*t = CreateThread(NULL, 0, proc, arg, 0, NULL);
+	return *t ? 0 : -1;
+}
+
+__inline static void thread_join(thread_t t)
+{
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+
+__inline static void mutex_init   (mutex_t *m) { InitializeCriticalSection(m); }
+__inline static void mutex_destroy(mutex_t *m) { DeleteCriticalSection(m); }
+__inline static void mutex_lock   (mutex_t *m) { EnterCriticalSection(m); }
+__inline static void mutex_unlock (mutex_t *m) { LeaveCriticalSection(m); }
+
+__inline static void cond_init     (cond_t *c) { InitializeConditionVariable(c); }
+__inline static void cond_destroy  (cond_t *c) { (void)c; }
+__inline static void cond_wait     (cond_t *c, mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+__inline static void cond_signal   (cond_t *c) { WakeConditionVariable(c); }
+__inline static void cond_broadcast(cond_t *c) { WakeAllConditionVariable(c); }
+
+__inline static unsigned cpu_count(void)
+{
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+}
+
+#else // POSIX
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_t       thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t  cond_t;
+
+#define THREAD_PROC(name, arg)	void *name(void *arg)
+#define THREAD_RETURN			return NULL
+
+__inline static int thread_create(thread_t *t, void *(*proc)(void *), void *arg)
+{
+	return pthread_create(t, NULL, proc, arg) ? -1 : 0;
+}
+
+__inline static void thread_join(thread_t t)
+{
+	pthread_join(t, NULL);
+}
+
+__inline static void mutex_init   (mutex_t *m) { pthread_mutex_init(m, NULL); }
+__inline static void mutex_destroy(mutex_t *m) { pthread_mutex_destroy(m); }
+__inline static void mutex_lock   (mutex_t *m) { pthread_mutex_lock(m); }
+__inline static void mutex_unlock (mutex_t *m) { pthread_mutex_unlock(m); }
+
+__inline static void cond_init     (cond_t *c) { pthread_cond_init(c, NULL); }
+__inline static void cond_destroy  (cond_t *c) { pthread_cond_destroy(c); }
+__inline static void cond_wait     (cond_t *c, mutex_t *m) { pthread_cond_wait(c, m); }
+__inline static void cond_signal   (cond_t *c) { pthread_cond_signal(c); }
+__inline static void cond_broadcast(cond_t *c) { pthread_cond_broadcast(c); }
+
+__inline static unsigned cpu_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+}
+
+#endif // _WIN32
+
+#endif //__THREAD_H__